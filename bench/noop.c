@@ -0,0 +1,6 @@
+// the reference command for the startup benchmarks: a process built and
+// started like the measured ones that does nothing at all. timing it in the
+// same run factors the machine out of the comparison.
+int main(void) {
+  return 0;
+}
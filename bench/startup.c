@@ -0,0 +1,301 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../cli.h"
+
+// execs a command over and over, interleaved with a reference command that
+// does nothing, and compares the startup cost of one relative to the other
+// against a checked in baseline. the baseline is a small json file like
+//
+//   {
+//     "tolerance": {"wall": 0.25, "minflt": 0.25, "maxrss": 0.25},
+//     "calc": {"wall": 1.20, "minflt": 1.30, "maxrss": 1.10}
+//   }
+//
+// where each entry is a multiple of the reference and a tolerance of 0.25
+// fails a metric more than 25% over its baseline. both commands run on the
+// same machine in the same run, so the ratios carry across machines where
+// absolute numbers would not. wall time is the median of all runs, page
+// faults the mean, rss the max.
+
+typedef struct bench_result {
+  double wall_us;
+  double minflt;
+  double maxrss_kb;
+} bench_result;
+
+static const char* const metric_names[] = {"wall", "minflt", "maxrss"};
+#define N_METRICS (sizeof(metric_names) / sizeof(metric_names[0]))
+
+void fail_fast(cli_err err);
+
+static double now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1e6 + (double)ts.tv_nsec / 1e3;
+}
+
+static int cmp_double(const void* a, const void* b) {
+  double x = *(const double*)a;
+  double y = *(const double*)b;
+  return (x > y) - (x < y);
+}
+
+// one fork/exec/wait of `cmd` with its output thrown away. returns the wall
+// time in microseconds, or a negative value if the command did not exit 0.
+// the child's own resource usage goes to `usage`.
+static double run_once(char** cmd, struct rusage* usage) {
+  double start = now_us();
+  pid_t pid = fork();
+  if (pid < 0) {
+    return -1;
+  }
+  if (pid == 0) {
+    int null = open("/dev/null", O_WRONLY);
+    if (null >= 0) {
+      dup2(null, STDOUT_FILENO);
+      dup2(null, STDERR_FILENO);
+    }
+    execv(cmd[0], cmd);
+    _exit(127);
+  }
+
+  int status;
+  if (wait4(pid, &status, 0, usage) != pid) {
+    return -1;
+  }
+  double end = now_us();
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    return -1;
+  }
+  return end - start;
+}
+
+// times `cmd` and `ref` turn about so drift on the machine hits both alike
+static bool bench_run(char** cmd, char** ref, int runs, bench_result out[2]) {
+  double* walls = malloc(sizeof(double) * 2 * (size_t)runs);
+  if (walls == NULL) {
+    return false;
+  }
+
+  char** const cmds[2] = {cmd, ref};
+  long minflt[2] = {0, 0};
+  long maxrss[2] = {0, 0};
+  for (int i = 0; i < runs; i++) {
+    for (int k = 0; k < 2; k++) {
+      struct rusage usage;
+      double wall = run_once(cmds[k], &usage);
+      if (wall < 0) {
+        fprintf(stderr, "err: %s failed on run %d\n", cmds[k][0], i);
+        free(walls);
+        return false;
+      }
+      walls[k * runs + i] = wall;
+      minflt[k] += usage.ru_minflt;
+      maxrss[k] = usage.ru_maxrss > maxrss[k] ? usage.ru_maxrss : maxrss[k];
+    }
+  }
+
+  for (int k = 0; k < 2; k++) {
+    qsort(walls + k * runs, (size_t)runs, sizeof(double), cmp_double);
+    out[k].wall_us = walls[k * runs + runs / 2];
+    out[k].minflt = (double)minflt[k] / runs;
+    out[k].maxrss_kb = (double)maxrss[k];
+  }
+  free(walls);
+  return true;
+}
+
+// each metric of `r` as a multiple of the same metric of `ref`
+static void bench_ratios(const bench_result* r,
+                         const bench_result* ref,
+                         double out[N_METRICS]) {
+  const double num[N_METRICS] = {r->wall_us, r->minflt, r->maxrss_kb};
+  const double den[N_METRICS] = {ref->wall_us, ref->minflt, ref->maxrss_kb};
+  for (size_t i = 0; i < N_METRICS; i++) {
+    out[i] = den[i] > 0 ? num[i] / den[i] : num[i];
+  }
+}
+
+static char* read_file(const char* path) {
+  FILE* f = fopen(path, "rb");
+  if (f == NULL) {
+    return NULL;
+  }
+  fseek(f, 0, SEEK_END);
+  long len = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  char* text = len < 0 ? NULL : malloc((size_t)len + 1);
+  if (text != NULL) {
+    text[fread(text, 1, (size_t)len, f)] = '\0';
+  }
+  fclose(f);
+  return text;
+}
+
+// the body of the object stored under `"key":` in `text`, or NULL. this is
+// not a json parser, only enough of one for the flat baseline file.
+static const char* json_object(const char* text, const char* key) {
+  char quoted[64];
+  snprintf(quoted, sizeof(quoted), "\"%s\"", key);
+  for (const char* p = strstr(text, quoted); p != NULL;
+       p = strstr(p + 1, quoted)) {
+    const char* q = p + strlen(quoted);
+    q += strspn(q, " \t\r\n");
+    if (*q != ':') {
+      continue;
+    }
+    q++;
+    q += strspn(q, " \t\r\n");
+    if (*q == '{') {
+      return q + 1;
+    }
+  }
+  return NULL;
+}
+
+static bool json_number(const char* obj, const char* key, double* out) {
+  const char* end = strchr(obj, '}');
+  char quoted[64];
+  snprintf(quoted, sizeof(quoted), "\"%s\"", key);
+  const char* p = strstr(obj, quoted);
+  if (p == NULL || (end != NULL && p > end)) {
+    return false;
+  }
+  p = strchr(p + strlen(quoted), ':');
+  if (p == NULL) {
+    return false;
+  }
+  char* num_end;
+  *out = strtod(p + 1, &num_end);
+  return num_end != p + 1;
+}
+
+static void print_entry(const char* name, const double ratios[N_METRICS]) {
+  printf("\"%s\": {\"wall\": %.2f, \"minflt\": %.2f, \"maxrss\": %.2f}\n",
+         name, ratios[0], ratios[1], ratios[2]);
+}
+
+// compares every ratio against the baseline entry `name`. a metric missing
+// from the baseline is reported and not checked.
+static bool bench_check(const char* baseline,
+                        const char* name,
+                        const double ratios[N_METRICS]) {
+  const char* entry = json_object(baseline, name);
+  const char* tolerance = json_object(baseline, "tolerance");
+  if (entry == NULL || tolerance == NULL) {
+    fprintf(stderr, "err: no baseline for %s\n", name);
+    return false;
+  }
+
+  bool ok = true;
+  for (size_t i = 0; i < N_METRICS; i++) {
+    double base;
+    double tol;
+    if (!json_number(entry, metric_names[i], &base) ||
+        !json_number(tolerance, metric_names[i], &tol)) {
+      printf("%s %s: %.2fx (no baseline)\n", name, metric_names[i],
+             ratios[i]);
+      continue;
+    }
+    double limit = base * (1.0 + tol);
+    bool pass = ratios[i] <= limit;
+    printf("%s %s: %.2fx, baseline %.2fx, limit %.2fx%s\n", name,
+           metric_names[i], ratios[i], base, limit, pass ? "" : " REGRESSED");
+    ok = ok && pass;
+  }
+  return ok;
+}
+
+int main(int argc, char** argv) {
+  cli_command* c = cli_command_new();
+  fail_fast(cli_init(c, "Measures process startup against a baseline.\n",
+                     "--baseline=file --reference=file --name=str "
+                     "[--runs=int] [--update] -- command [args]...\n",
+                     argc, argv));
+
+  const char* baseline_path = NULL;
+  fail_fast(cli_add_path_option(c, "baseline", "The baseline json file.",
+                                &baseline_path, CLI_PATH_FILE, false));
+  const char* reference = NULL;
+  fail_fast(cli_add_path_option(c, "reference",
+                                "A command that does nothing, timed alongside.",
+                                &reference, CLI_PATH_FILE, true));
+  char name[CLI_OPT_TOKEN_MAX_LEN] = "";
+  fail_fast(cli_add_str_option(c, "name", "The entry in the baseline.", name,
+                               true, CLI_OPT_TOKEN_MAX_LEN));
+  int runs = 200;
+  fail_fast(cli_add_int_option(c, "runs", "Execs to time. 200 by default.",
+                               &runs, false));
+  bool update = false;
+  fail_fast(cli_add_flag(c, "update", "Print a baseline entry, don't check.",
+                         &update));
+  const char** cmd = NULL;
+  size_t n_cmd = 0;
+  fail_fast(cli_add_path_arguments(c, &cmd, &n_cmd, CLI_PATH_ANY));
+
+  cli_err err = cli_parse(c);
+  if (err != CLI_OK) {
+    cli_print_err(err);
+    cli_print_help_and_exit(c, 1);
+  }
+  if (n_cmd == 0 || runs <= 0 || (!update && baseline_path == NULL)) {
+    cli_print_help_and_exit(c, 1);
+  }
+
+  char** exec_argv = calloc(n_cmd + 1, sizeof(char*));
+  if (exec_argv == NULL) {
+    return 1;
+  }
+  memcpy(exec_argv, cmd, n_cmd * sizeof(char*));
+
+  char* ref_argv[] = {(char*)reference, NULL};
+
+  // one untimed run of each to fault in the binaries and shared libraries
+  struct rusage usage;
+  if (run_once(exec_argv, &usage) < 0 || run_once(ref_argv, &usage) < 0) {
+    fprintf(stderr, "err: %s or %s failed\n", exec_argv[0], reference);
+    return 1;
+  }
+
+  bench_result r[2];
+  if (!bench_run(exec_argv, ref_argv, runs, r)) {
+    return 1;
+  }
+  double ratios[N_METRICS];
+  bench_ratios(&r[0], &r[1], ratios);
+  printf("%s: %.0f us, %.0f faults, %.0f KiB; reference %.0f us, %.0f faults, "
+         "%.0f KiB\n",
+         name, r[0].wall_us, r[0].minflt, r[0].maxrss_kb, r[1].wall_us,
+         r[1].minflt, r[1].maxrss_kb);
+  if (update) {
+    print_entry(name, ratios);
+    return 0;
+  }
+
+  char* baseline = read_file(baseline_path);
+  if (baseline == NULL) {
+    fprintf(stderr, "err: could not read %s\n", baseline_path);
+    return 1;
+  }
+  bool ok = bench_check(baseline, name, ratios);
+  free(baseline);
+  free(exec_argv);
+  cli_command_destroy(c);
+  return ok ? 0 : 1;
+}
+
+void fail_fast(cli_err err) {
+  if (err != CLI_OK) {
+    cli_print_err(err);
+    exit(1);
+  }
+}
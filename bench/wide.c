@@ -0,0 +1,40 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../cli.h"
+
+// a command with as many options as a big generated wrapper, to keep the
+// cost of cli_init and registration honest. build with CLI_MAX_OPTS >= 500.
+#define WIDE_N_OPTS 500
+
+static char names[WIDE_N_OPTS][8];
+static int values[WIDE_N_OPTS];
+
+void fail_fast(cli_err err);
+
+int main(int argc, char** argv) {
+  cli_command* c = cli_command_new();
+  fail_fast(cli_init(c, "500 int options.\n", "[-oN=int]...\n", argc, argv));
+
+  for (int i = 0; i < WIDE_N_OPTS; i++) {
+    snprintf(names[i], sizeof(names[i]), "o%d", i);
+    fail_fast(cli_add_int_option(c, names[i], "An int.", &values[i], false));
+  }
+
+  fail_fast(cli_parse(c));
+
+  long sum = 0;
+  for (int i = 0; i < WIDE_N_OPTS; i++) {
+    sum += values[i];
+  }
+  printf("%ld\n", sum);
+  return 0;
+}
+
+void fail_fast(cli_err err) {
+  if (err != CLI_OK) {
+    cli_print_err(err);
+    exit(1);
+  }
+}
@@ -10,74 +10,147 @@
  *
  */
 
+// statx(2) on linux
+#define _GNU_SOURCE
+
+#include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <float.h>
+#include <fnmatch.h>
 #include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include "cli.h"
 
-void cli_print_err(cli_err err) {
+const char* cli_err_str(cli_err err) {
   switch (err) {
+    case CLI_OK:
+      return "ok.";
+    case CLI_PRINT_HELP_AND_EXIT:
+      return "help was requested.";
     case CLI_PARSE_FAILED_INT:
-      fprintf(stderr, "err: token parse failed for integer.\n");
-      break;
+      return "token parse failed for integer.";
     case CLI_PARSE_FAILED_BOOL:
-      fprintf(stderr, "err: token parse failed for boolean.\n");
-      break;
+      return "token parse failed for boolean.";
     case CLI_PARSE_FAILED_FLOAT:
-      fprintf(stderr, "err: token parse failed for float.\n");
-      break;
+      return "token parse failed for float.";
     case CLI_PARSE_FAILED_STR:
-      fprintf(stderr, "err: token parse failed for str: buf too small.\n");
-      break;
+      return "token parse failed for str: buf too small.";
     case CLI_FULL_REGISTRY:
-      fprintf(stderr, "err: registry full.\n");
-      break;
+      return "registry full.";
     case CLI_NOT_FOUND:
-      fprintf(stderr, "err: token not found.\n");
-      break;
+      return "token not found.";
     case CLI_NAME_REQUIRED:
-      fprintf(stderr, "err: option name not found.\n");
-      break;
+      return "option name not found.";
     case CLI_UNSEEN_REQ_OPTS:
-      fprintf(stderr, "err: unseen required options.\n");
-      break;
+      return "unseen required options.";
     case CLI_OUT_OF_BOUNDS:
-      fprintf(stderr, "err: out of bounds during parse.\n");
-      break;
+      return "out of bounds during parse.";
     case CLI_ALREADY_SEEN:
-      fprintf(stderr, "err: option was already seen.\n");
-      break;
+      return "option was already seen.";
     case CLI_ARG_COUNT:
-      fprintf(stderr, "err: misconfigured positional arguments.\n");
-      break;
+      return "misconfigured positional arguments.";
     case CLI_TOKEN_TOO_LONG:
-      fprintf(stderr, "err: token longer then allowed max.\n");
-      break;
+      return "token longer then allowed max.";
     case CLI_USAGE_STR_TOO_LONG:
-      fprintf(stderr, "err: usage string longer then allowed max.\n");
-      break;
-    default:
-      break;
+      return "usage string longer then allowed max.";
+    case CLI_AMBIGUOUS_OPT:
+      return "option prefix matches more than one option.";
+    case CLI_PARSE_FAILED_CHOICE:
+      return "token parse failed for choice: not a choice.";
+    case CLI_PARSE_FAILED_CUSTOM:
+      return "token parse failed for custom type.";
+    case CLI_PARSE_FAILED_SIZE:
+      return "token parse failed for size.";
+    case CLI_PARSE_FAILED_DURATION:
+      return "token parse failed for duration.";
+    case CLI_TYPE_MISMATCH:
+      return "option was registered with another type.";
+    case CLI_BAD_QUOTING:
+      return "unterminated quote or escape in line.";
+    case CLI_BAD_SNAPSHOT:
+      return "snapshot is corrupt or from another command.";
+    case CLI_EXCLUSIVE_OPTS:
+      return "mutually exclusive options were given.";
+    case CLI_UNMET_REQUIRES:
+      return "an option is missing an option it requires.";
+    case CLI_UNSEEN_ONE_OF:
+      return "one of a set of options is required.";
+    case CLI_PARSE_FAILED_UTF8:
+      return "string value is not valid UTF-8.";
+    case CLI_BAD_PATHS:
+      return "paths failed their checks.";
+    case CLI_GLOB_LIMIT:
+      return "glob patterns matched too many paths.";
+    case CLI_PARSE_FAILED_FILE:
+      return "could not read file for option.";
+    case CLI_PARSE_FAILED_RANGE:
+      return "could not parse range list.";
+    case CLI_RANGE_OVERLAP:
+      return "ranges overlap.";
+    case CLI_RANGE_OUT_OF_BOUNDS:
+      return "range is out of bounds.";
+    case CLI_PARSE_FAILED_KV:
+      return "expected a key=value pair.";
+    case CLI_DUPLICATE_KEY:
+      return "key was given more than once.";
+    case CLI_STREAM_FAILED:
+      return "reading the argument stream failed.";
+    case CLI_STREAM_RECORD_TOO_LONG:
+      return "streamed argument too long.";
+    case CLI_OUT_OF_MEMORY:
+      return "out of memory.";
+    case CLI_NOT_BOUND:
+      return "no struct bound to command.";
+    case CLI_ALREADY_BOUND:
+      return "struct already bound to command.";
+    case CLI_BAD_CHOICES:
+      return "choices were empty or repeated.";
+    case CLI_BAD_GROUP:
+      return "group is the command itself or already attached.";
+  }
+  return "unknown error.";
+}
+
+void cli_print_err(cli_err err) {
+  if (err != CLI_OK && err != CLI_PRINT_HELP_AND_EXIT) {
+    fprintf(stderr, "err: %s\n", cli_err_str(err));
   }
 }
 
 struct cli_opt;
 struct cli_arg;
 
-typedef cli_err (*cli_opt_parser)(struct cli_opt* opt, const char* token);
-typedef cli_err (*cli_arg_parser)(struct cli_arg* arg, const char* token);
+// parsers get the value token and its length. flags get (NULL, 0).
+typedef cli_err (*cli_opt_parser)(struct cli_opt* opt,
+                                  const char* token,
+                                  size_t len);
+typedef cli_err (*cli_arg_parser)(struct cli_arg* arg,
+                                  const char* token,
+                                  size_t len);
 
 // internal box to carry the string buffer size so we don't overflow :(
 // this is allocated in the public API and deallocated here after the parse.
 typedef struct str_box {
   char* ptr;
   size_t sz;
+  bool utf8;  // reject values that are not well formed UTF-8
 } str_box;
 
 // an array manager to deal with the liftime for the above.
@@ -85,14 +158,16 @@ typedef struct str_boxes {
   str_box** arr;
   size_t cap;
   size_t idx;
+  bool utf8;  // the setting for new boxes
 } str_boxes;
 
-void str_boxes_init(str_boxes* b, size_t cap) {
+bool str_boxes_init(str_boxes* b, size_t cap) {
   str_box** arr = (str_box**)calloc(cap, sizeof(str_box));
-  CLI_CHECK_MEM_ALLOC(arr);
   b->arr = arr;
   b->cap = cap;
   b->idx = 0;
+  b->utf8 = false;
+  return arr != NULL;
 }
 
 // create a new str_box and return a reference via sb_val
@@ -102,9 +177,12 @@ cli_err str_boxes_add(str_boxes* b, char* ptr, size_t sz, str_box** sb_val) {
   }
 
   str_box* sb = (str_box*)malloc(sizeof(str_box));
-  CLI_CHECK_MEM_ALLOC(sb);
+  if (sb == NULL) {
+    return CLI_OUT_OF_MEMORY;
+  }
   sb->ptr = ptr;
   sb->sz = sz;
+  sb->utf8 = b->utf8;
 
   // add the the arena.
   b->arr[b->idx] = sb;
@@ -121,6 +199,85 @@ void str_boxes_cleanup(str_boxes* b) {
   free(b->arr);
 }
 
+// a general arena for other per option parser state (choice tables etc.) that
+// has to live as long as the command. grows on demand since most commands
+// never use it.
+typedef struct cli_arena {
+  void** arr;
+  size_t cap;
+  size_t idx;
+} cli_arena;
+
+void cli_arena_init(cli_arena* a) {
+  a->arr = NULL;
+  a->cap = 0;
+  a->idx = 0;
+}
+
+// returns zeroed memory owned by the arena, NULL when out of memory
+void* cli_arena_alloc(cli_arena* a, size_t sz) {
+  if (a->idx == a->cap) {
+    size_t cap = a->cap == 0 ? 8 : a->cap * 2;
+    void** arr = (void**)realloc(a->arr, cap * sizeof(void*));
+    if (arr == NULL) {
+      return NULL;
+    }
+    a->arr = arr;
+    a->cap = cap;
+  }
+
+  void* p = calloc(1, sz);
+  if (p == NULL) {
+    return NULL;
+  }
+  a->arr[a->idx] = p;
+  a->idx++;
+  return p;
+}
+
+void cli_arena_cleanup(cli_arena* a) {
+  for (; a->idx > 0; a->idx--) {
+    free(a->arr[a->idx - 1]);
+  }
+  free(a->arr);
+}
+
+// choices are resolved with a perfect hash built at registration: we search
+// for a seed under which every choice lands in its own slot, so a parse is one
+// hash, one probe and one strcmp.
+typedef struct choice_box {
+  int* out;
+  const char* const* choices;
+  size_t n;
+  uint32_t seed;
+  size_t mask;  // table size - 1, always a power of two
+  int slots[];   // choice index + 1, 0 when empty
+} choice_box;
+
+uint32_t choice_hash(const char* s, size_t len, uint32_t seed) {
+  uint32_t h = 2166136261u ^ seed;
+  for (size_t i = 0; i < len; i++) {
+    h ^= (unsigned char)s[i];
+    h *= 16777619u;
+  }
+  return h ^ (h >> 15);
+}
+
+// try to place every choice under `seed`. false on the first collision.
+bool choice_box_fill(choice_box* box, uint32_t seed) {
+  memset(box->slots, 0, (box->mask + 1) * sizeof(int));
+  for (size_t i = 0; i < box->n; i++) {
+    const char* choice = box->choices[i];
+    size_t slot = choice_hash(choice, strlen(choice), seed) & box->mask;
+    if (box->slots[slot] != 0) {
+      return false;
+    }
+    box->slots[slot] = (int)i + 1;
+  }
+  box->seed = seed;
+  return true;
+}
+
 typedef struct cli_opt {
   const char* name;       // name of the arg without `-` or `--` prefix.
   const char* usage;      // A usage statement for help
@@ -129,24 +286,77 @@ typedef struct cli_opt {
   bool required;          // whether this option must be parsed
   bool seen;              // set when opt is seen in the parser
   bool is_flag;           // Tells parser to pass NULL argument to parser
+  bool pending;           // lazy mode: raw token not converted yet
+  const char* raw;        // the last value token, as fed
+  size_t raw_len;         // length of raw
+  bool repeatable;        // may be given more than once (key=value tables)
+  cli_action action;      // deferred work for cli_run_actions, if any
+  void* action_ctx;
+  size_t field;  // 1 + index into the bound struct's fields, 0 if none
 } cli_opt;
 
+// constraints between own options, kept as bitmasks over option indices
+#define CLI_OPT_WORDS ((CLI_MAX_OPTS + 63) / 64)
+
+typedef enum cli_rule {
+  CLI_RULE_EXCLUSIVE = 0,  // at most one of members
+  CLI_RULE_REQUIRES,       // any of members needs all of needs
+  CLI_RULE_ONE_OF          // at least one of members
+} cli_rule;
+
+typedef struct cli_constraint {
+  cli_rule rule;
+  uint64_t members[CLI_OPT_WORDS];
+  uint64_t needs[CLI_OPT_WORDS];
+  const char* desc;  // what was violated, for cli_violated_constraint
+  struct cli_constraint* next;
+} cli_constraint;
+
 typedef struct cli_opts {
-  cli_opt** opts;  // the flag options to be parsed
-  size_t cap;      // capacity for option array
-  size_t idx;      // the current idx into the option array
+  cli_opt** opts;    // the flag options to be parsed
+  cli_opt** sorted;  // the same options ordered by name for lookups
+  size_t cap;        // capacity for option array
+  size_t idx;        // the current idx into the option array
+  bool indexed;      // false when `sorted` is stale after an add
+  bool abbrev;       // resolve unambiguous prefixes like getopt_long
+  bool lazy;         // defer value conversion to the cli_get_* getters
+  struct cli_opts* shared[CLI_MAX_GROUPS];  // attached option groups
+  size_t n_shared;
+  cli_constraint* constraints;  // checked in order, allocated in the arena
+  cli_constraint* last_constraint;
 } cli_opts;
 
+// own options are index 0, attached groups follow in attach order
+cli_opts* cli_opts_at(cli_opts* opts, size_t g) {
+  return g == 0 ? opts : opts->shared[g - 1];
+}
+
+// options across the own set and every attached group
+size_t cli_opts_total(cli_opts* opts) {
+  size_t n = 0;
+  for (size_t g = 0; g <= opts->n_shared; g++) {
+    n += cli_opts_at(opts, g)->idx;
+  }
+  return n;
+}
+
 // flag opts API
 
-// TODO mem error handling
-void cli_opts_init(cli_opts* opts, size_t cap) {
+bool cli_opts_init(cli_opts* opts, size_t cap) {
   cli_opt** opts_arr = (cli_opt**)calloc(cap, sizeof(cli_opt*));
-  CLI_CHECK_MEM_ALLOC(opts_arr);
+  cli_opt** sorted_arr = (cli_opt**)calloc(cap, sizeof(cli_opt*));
 
   opts->opts = opts_arr;
+  opts->sorted = sorted_arr;
   opts->idx = 0;
   opts->cap = cap;
+  opts->indexed = false;
+  opts->abbrev = false;
+  opts->lazy = false;
+  opts->n_shared = 0;
+  opts->constraints = NULL;
+  opts->last_constraint = NULL;
+  return opts_arr != NULL && sorted_arr != NULL;
 }
 
 void cli_opts_cleanup(cli_opts* opts) {
@@ -154,6 +364,7 @@ void cli_opts_cleanup(cli_opts* opts) {
     free(opts->opts[opts->idx - 1]);
   }
   free(opts->opts);
+  free(opts->sorted);
 }
 
 cli_err cli_opts_add(cli_opts* opts,
@@ -180,7 +391,9 @@ cli_err cli_opts_add(cli_opts* opts,
   }
 
   cli_opt* o = (cli_opt*)malloc(sizeof(cli_opt));
-  CLI_CHECK_MEM_ALLOC(o);
+  if (o == NULL) {
+    return CLI_OUT_OF_MEMORY;
+  }
 
   o->name = name;
   o->usage = usage;
@@ -189,20 +402,31 @@ cli_err cli_opts_add(cli_opts* opts,
   o->required = required;
   o->seen = false;
   o->is_flag = is_flag;
+  o->pending = false;
+  o->raw = NULL;
+  o->raw_len = 0;
+  o->repeatable = false;
+  o->action = NULL;
+  o->action_ctx = NULL;
+  o->field = 0;
 
   opts->opts[opts->idx] = o;
   opts->idx++;  // current idx is always the len of the opts
+  opts->indexed = false;
   return CLI_OK;
 }
 
 bool cli_opts_n_required_seen(cli_opts* opts) {
   size_t count_req = 0;
   size_t count_seen = 0;
-  for (size_t i = 0; i < opts->idx; i++) {
-    if (opts->opts[i]->required) {
-      count_req++;
-      if (opts->opts[i]->seen) {
-        count_seen++;
+  for (size_t g = 0; g <= opts->n_shared; g++) {
+    cli_opts* o = cli_opts_at(opts, g);
+    for (size_t i = 0; i < o->idx; i++) {
+      if (o->opts[i]->required) {
+        count_req++;
+        if (o->opts[i]->seen) {
+          count_seen++;
+        }
       }
     }
   }
@@ -210,24 +434,233 @@ bool cli_opts_n_required_seen(cli_opts* opts) {
   return count_req == count_seen;
 }
 
-cli_opt* cli_opts_find(cli_opts* opts, const char* name) {
+// set the bit of each named own option in `mask`
+cli_err cli_opts_mask(cli_opts* opts,
+                      const char* const* names,
+                      size_t n,
+                      uint64_t* mask) {
+  if (names == NULL || n == 0) {
+    return CLI_NAME_REQUIRED;
+  }
+
+  for (size_t k = 0; k < n; k++) {
+    if (names[k] == NULL) {
+      return CLI_NAME_REQUIRED;
+    }
+    size_t i = 0;
+    while (i < opts->idx && strcmp(opts->opts[i]->name, names[k]) != 0) {
+      i++;
+    }
+    if (i == opts->idx) {
+      return CLI_NOT_FOUND;
+    }
+    mask[i / 64] |= UINT64_C(1) << (i % 64);
+  }
+  return CLI_OK;
+}
+
+// check every constraint against a set of seen own options in one pass.
+// the first violation is reported through `violated`.
+cli_err cli_opts_check_seen(const cli_opts* opts,
+                            const uint64_t* seen,
+                            const cli_constraint** violated) {
+  for (const cli_constraint* c = opts->constraints; c != NULL; c = c->next) {
+    size_t words_hit = 0;  // words with any member seen
+    bool several = false;  // a single word with more than one member seen
+    bool missing = false;  // some needed option is unseen
+    for (size_t w = 0; w < CLI_OPT_WORDS; w++) {
+      uint64_t m = seen[w] & c->members[w];
+      words_hit += m != 0;
+      several |= (m & (m - 1)) != 0;
+      missing |= (seen[w] & c->needs[w]) != c->needs[w];
+    }
+
+    cli_err err = CLI_OK;
+    switch (c->rule) {
+      case CLI_RULE_EXCLUSIVE:
+        if (several || words_hit > 1) {
+          err = CLI_EXCLUSIVE_OPTS;
+        }
+        break;
+      case CLI_RULE_REQUIRES:
+        if (words_hit > 0 && missing) {
+          err = CLI_UNMET_REQUIRES;
+        }
+        break;
+      case CLI_RULE_ONE_OF:
+        if (words_hit == 0) {
+          err = CLI_UNSEEN_ONE_OF;
+        }
+        break;
+    }
+
+    if (err != CLI_OK) {
+      *violated = c;
+      return err;
+    }
+  }
+  return CLI_OK;
+}
+
+cli_err cli_opts_check_constraints(cli_opts* opts,
+                                   const cli_constraint** violated) {
+  if (opts->constraints == NULL) {
+    return CLI_OK;
+  }
+
+  uint64_t seen[CLI_OPT_WORDS] = {0};
   for (size_t i = 0; i < opts->idx; i++) {
-    if (strcmp(opts->opts[i]->name, name) == 0) {
-      return opts->opts[i];
+    if (opts->opts[i]->seen) {
+      seen[i / 64] |= UINT64_C(1) << (i % 64);
+    }
+  }
+  return cli_opts_check_seen(opts, seen, violated);
+}
+
+int cli_opt_cmp(const void* a, const void* b) {
+  return strcmp((*(cli_opt* const*)a)->name, (*(cli_opt* const*)b)->name);
+}
+
+// (re)build the sorted name index. registration is done by the time we parse
+// so this normally runs once per command.
+void cli_opts_build_index(cli_opts* opts) {
+  if (opts->indexed) {
+    return;
+  }
+  memcpy(opts->sorted, opts->opts, opts->idx * sizeof(cli_opt*));
+  qsort(opts->sorted, opts->idx, sizeof(cli_opt*), cli_opt_cmp);
+  opts->indexed = true;
+}
+
+// first position in the sorted index whose name is >= the `len` byte prefix.
+size_t cli_opts_lower_bound(cli_opts* opts, const char* prefix, size_t len) {
+  cli_opts_build_index(opts);
+
+  size_t lo = 0;
+  size_t hi = opts->idx;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (strncmp(opts->sorted[mid]->name, prefix, len) < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+// exact lookup in the own index, then in each attached group
+cli_opt* cli_opts_find(cli_opts* opts, const char* name) {
+  for (size_t g = 0; g <= opts->n_shared; g++) {
+    cli_opts* o = cli_opts_at(opts, g);
+    size_t i = cli_opts_lower_bound(o, name, strlen(name) + 1);
+    if (i < o->idx && strcmp(o->sorted[i]->name, name) == 0) {
+      return o->sorted[i];
     }
   }
   return NULL;
 }
 
-void cli_opt_print_message(cli_opt* o, char* buf) {
-  size_t name_l = strlen(o->name);
-  size_t usage_l = strlen(o->usage);
-  int err =
-      snprintf(buf, name_l + usage_l + 5, "\t-%s\t\t%s\n", o->name, o->usage);
+// convert the token now, or in lazy mode just keep the slice for later
+cli_err cli_opt_apply(cli_opts* opts,
+                      cli_opt* opt,
+                      const char* token,
+                      size_t len) {
+  opt->raw = token;
+  opt->raw_len = len;
+  // repeated options only keep their last raw token, so they never wait
+  if (opts->lazy && !opt->repeatable) {
+    opt->pending = true;
+    return CLI_OK;
+  }
+  return opt->parser(opt, token, len);
+}
+
+// run a conversion deferred by lazy mode. the result is cached in the
+// option's target so this only parses once.
+cli_err cli_opt_resolve(cli_opt* opt) {
+  if (!opt->pending) {
+    return CLI_OK;
+  }
+
+  cli_err err = opt->parser(opt, opt->raw, opt->raw_len);
+  if (err != CLI_OK) {
+    return err;
+  }
+  opt->pending = false;
+  return CLI_OK;
+}
+
+// names in one index starting with the `len` byte prefix: 0, 1 or 2 for
+// "more than one". matches form a contiguous run in the sorted index and an
+// exact match sorts first, so `first` is it if there is one.
+size_t cli_opts_match(cli_opts* opts,
+                      const char* name,
+                      size_t len,
+                      cli_opt** first) {
+  size_t i = cli_opts_lower_bound(opts, name, len);
+  if (i == opts->idx || strncmp(opts->sorted[i]->name, name, len) != 0) {
+    return 0;
+  }
+  *first = opts->sorted[i];
+
+  if (i + 1 < opts->idx &&
+      strncmp(opts->sorted[i + 1]->name, name, len) == 0) {
+    return 2;
+  }
+  return 1;
+}
+
+// resolve the `len` byte name at `name` (not necessarily NUL terminated)
+// against the own index and then the attached groups. an exact match always
+// wins. otherwise, if abbreviations are on, a prefix of exactly one name
+// across all of them resolves to it.
+cli_err cli_opts_lookup(cli_opts* opts,
+                        const char* name,
+                        size_t len,
+                        cli_opt** out) {
+  size_t n_match = 0;
+  cli_opt* match = NULL;
+
+  for (size_t g = 0; g <= opts->n_shared; g++) {
+    cli_opt* first;
+    size_t n = cli_opts_match(cli_opts_at(opts, g), name, len, &first);
+    if (n == 0) {
+      continue;
+    }
+    if (first->name[len] == '\0') {
+      *out = first;
+      return CLI_OK;
+    }
+    n_match += n;
+    match = first;
+  }
+
+  if (n_match == 0 || !opts->abbrev) {
+    return CLI_NOT_FOUND;
+  }
+  if (n_match > 1) {
+    return CLI_AMBIGUOUS_OPT;
+  }
+
+  *out = match;
+  return CLI_OK;
+}
+
+cli_err choice_opt_parser(cli_opt* opt, const char* token, size_t len);
 
-  if (err < 0) {
-    fprintf(stderr, "Assertion Error: cli_opt_print_message failed: %d\n", err);
+void cli_opt_print_message(cli_opt* o, FILE* f) {
+  fprintf(f, "\t-%s\t\t%s", o->name, o->usage);
+
+  // list the accepted values for choice options
+  if (o->parser == choice_opt_parser) {
+    choice_box* box = (choice_box*)(o->value);
+    for (size_t i = 0; i < box->n; i++) {
+      fprintf(f, "%s%s", i == 0 ? " {" : "|", box->choices[i]);
+    }
+    fprintf(f, "}");
   }
+  fprintf(f, "\n");
 }
 
 // flag arg API
@@ -236,20 +669,27 @@ void cli_opt_print_message(cli_opt* o, char* buf) {
 typedef struct cli_arg {
   cli_arg_parser parser;
   void* value;
+  const char* raw;  // the token, as fed
+  size_t raw_len;
+  size_t field;  // 1 + index into the bound struct's fields, 0 if none
 } cli_arg;
 
 typedef struct cli_args {
   cli_arg** args;
   size_t cap;
   size_t idx;
+  bool variadic;  // the last argument takes every remaining positional
+  bool streamed;  // the last argument is read from a stream, not argv
 } cli_args;
 
-void cli_args_init(cli_args* args, size_t cap) {
+bool cli_args_init(cli_args* args, size_t cap) {
   cli_arg** args_arr = (cli_arg**)calloc(cap, sizeof(cli_arg*));
-  CLI_CHECK_MEM_ALLOC(args_arr);
   args->args = args_arr;
   args->idx = 0;
   args->cap = cap;
+  args->variadic = false;
+  args->streamed = false;
+  return args_arr != NULL;
 }
 
 void cli_args_cleanup(cli_args* args) {
@@ -260,401 +700,4388 @@ void cli_args_cleanup(cli_args* args) {
 }
 
 cli_err cli_args_add(cli_args* args, cli_arg_parser parser, void* value) {
+  if (args->variadic || args->streamed) {
+    return CLI_ARG_COUNT;
+  }
+
   if (args->idx == args->cap) {
     return CLI_FULL_REGISTRY;
   }
 
   cli_arg* a = (cli_arg*)malloc(sizeof(cli_arg));
-  CLI_CHECK_MEM_ALLOC(a);
+  if (a == NULL) {
+    return CLI_OUT_OF_MEMORY;
+  }
   a->parser = parser;
   a->value = value;
+  a->raw = NULL;
+  a->raw_len = 0;
+  a->field = 0;
 
   args->args[args->idx] = a;
   args->idx++;
   return CLI_OK;
 }
 
-// the main cli_parse function
-// result type is used to report more info about the failed parse.
+// token pre-classification
+// every argv token is swept once up front for its length and its first `=`,
+// and sorted into one of the kinds below. the state machine then switches on
+// the kind instead of re-comparing prefixes per token.
 
-cli_err cli_parse_loop(cli_opts* opts, cli_args* args, int argc, char** argv) {
-  int argv_i = 1;
+typedef enum cli_tok_kind {
+  CLI_TOK_POSITIONAL = 0,  // no dash prefix
+  CLI_TOK_SHORT,           // -x or -x=1
+  CLI_TOK_LONG,            // --name or --name=1
+  CLI_TOK_TERMINATOR,      // exactly `--`
+  CLI_TOK_HELP             // -h, --h, -help or --help
+} cli_tok_kind;
 
-  // if we've configured correctly we should always have help, h flags out of
-  // the box...
+typedef struct cli_tok {
+  uint8_t kind;     // cli_tok_kind
+  uint8_t dashes;   // prefix length for short and long tokens
+  uint32_t eq;      // offset of the first `=`, 0 when there is none
+  size_t len;
+} cli_tok;
 
-  if (opts != NULL) {
-    while (argv_i < argc) {
-      char* token = argv[argv_i];
+// the sweep stores a token as one word: the kind in the low bits and the
+// offset of its first `=` above them. the length is kept next to it.
+#define CLI_TOK_KIND_BITS 3
+#define CLI_TOK_EQ_MAX (UINT32_MAX >> CLI_TOK_KIND_BITS)
 
-      // printf("current token: %s\n", token);
-      //  check an exact match on delimiter first
-      if ((strcmp(token, "--") == 0)) {
-        argv_i++;
-        break;
-      }
+uint32_t cli_tok_pack(const cli_tok* t) {
+  return (uint32_t)t->kind | t->eq << CLI_TOK_KIND_BITS;
+}
 
-      // move the token pointer based on whether we detect a flag prefix
-      // (--, -)
-      if ((strncmp(token, "--", 2)) == 0) {
-        token += 2;
-      } else if ((strncmp(token, "-", 1)) == 0) {
-        token += 1;
-      } else {
-        break;
-      }
+void cli_tok_unpack(uint32_t word, size_t len, cli_tok* t) {
+  t->kind = (uint8_t)(word & ((1u << CLI_TOK_KIND_BITS) - 1));
+  t->dashes = t->kind == CLI_TOK_LONG ? 2 : t->kind == CLI_TOK_SHORT ? 1 : 0;
+  t->eq = word >> CLI_TOK_KIND_BITS;
+  t->len = len;
+}
 
-      // short circuit the parse if we encounter help ... we immediately
-      // break out of the parse and should exit with the usage message
-      if ((strcmp(token, "h") == 0) || (strcmp(token, "help") == 0)) {
-        return CLI_PRINT_HELP_AND_EXIT;
-      }
+// aligned 16 byte loads can read past the terminator but never across a page,
+// which address sanitizers still report.
+#if defined(__SSE2__) && (defined(__GNUC__) || defined(__clang__))
+#define CLI_NO_SANITIZE_ADDRESS __attribute__((no_sanitize_address))
+#else
+#define CLI_NO_SANITIZE_ADDRESS
+#endif
 
-      char tok_[CLI_OPT_TOKEN_MAX_LEN] = "";
-      strcpy(tok_, token);
-      char* tok_str = tok_;
+// length of a NUL terminated token and the offset of its first `=` in a
+// single pass. *eq is set to the length when there is no `=`.
+CLI_NO_SANITIZE_ADDRESS
+size_t cli_scan_token(const char* s, size_t* eq) {
+#if defined(__SSE2__)
+  const __m128i nul = _mm_setzero_si128();
+  const __m128i equals = _mm_set1_epi8('=');
+  size_t skip = (uintptr_t)s & 15;
+  const char* block = s - skip;
+  unsigned keep = 0xffffu << skip;
+  size_t found = SIZE_MAX;
 
-      // sep on =
-      char* first = strsep(&tok_str, "=");
-      char* second = strsep(&tok_str, "=");
-      // first should be guarateed
-      //  second will either be none or garbage if = is abused
+  for (;;) {
+    __m128i v = _mm_load_si128((const __m128i*)block);
+    unsigned z = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nul)) & keep;
+    unsigned e = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, equals)) & keep;
+    keep = 0xffffu;
 
-      // printf("[%s, %s]\n", first, second);
+    // ignore any `=` that sits after the terminator
+    if (z != 0) {
+      e &= (z & -z) - 1;
+    }
+    if (found == SIZE_MAX && e != 0) {
+      found = (size_t)(block - s) + (size_t)__builtin_ctz(e);
+    }
+    if (z != 0) {
+      size_t len = (size_t)(block - s) + (size_t)__builtin_ctz(z);
+      *eq = found == SIZE_MAX ? len : found;
+      return len;
+    }
+    block += 16;
+  }
+#else
+  size_t len = 0;
+  size_t found = SIZE_MAX;
+  for (; s[len] != '\0'; len++) {
+    if (s[len] == '=' && found == SIZE_MAX) {
+      found = len;
+    }
+  }
+  *eq = found == SIZE_MAX ? len : found;
+  return len;
+#endif
+}
 
-      cli_opt* opt;
-      if ((opt = cli_opts_find(opts, first)) == NULL) {
-        return CLI_NOT_FOUND;
-      }
-      // check if we've seen this flag
-      if (opt->seen) {
-        return CLI_ALREADY_SEEN;
-      }
+// classify a token whose length and first `=` are already known
+void cli_classify(const char* token, size_t len, size_t eq, cli_tok* t) {
+  t->kind = CLI_TOK_POSITIONAL;
+  t->dashes = 0;
+  t->eq = 0;
+  t->len = len;
 
-      // set the seen flag for the opt...
-      opt->seen = true;
+  if (len == 0 || token[0] != '-') {
+    return;
+  }
 
-      // handle case where opt->is_flag = true;
-      if (opt->is_flag) {
-        cli_err err = opt->parser(opt, NULL);
-        if (err != CLI_OK) {
-          return err;
-        }
-        // incr += 1 and skip to next iter
-        argv_i++;
+  if (len >= 2 && token[1] == '-') {
+    if (len == 2) {
+      t->kind = CLI_TOK_TERMINATOR;
+      return;
+    }
+    t->kind = CLI_TOK_LONG;
+    t->dashes = 2;
+  } else {
+    t->kind = CLI_TOK_SHORT;
+    t->dashes = 1;
+  }
 
-        continue;
-      }
-      // we have a valid token like --data=42 split -> data, 42
-      // it must be a value parser
-      if (second != NULL) {
-        cli_err err = opt->parser(opt, second);
-        if (err != CLI_OK) {
-          return err;
-        }
-        argv_i++;
-      } else {
-        // we have a single arg but we want to do a value lookup in the
-        // next index...
+  // tokens too long for the offset keep the `=` inside the name and fail
+  // the lookup, no option name is anywhere near that long.
+  if (eq < len && eq <= CLI_TOK_EQ_MAX) {
+    t->eq = (uint32_t)eq;
+  }
 
-        // check argv_i is not at the end so we don't reach over argv
-        if (argv_i + 1 == argc) {
-          return CLI_OUT_OF_BOUNDS;
-        }
+  const char* name = token + t->dashes;
+  size_t name_len = len - t->dashes;
+  if ((name_len == 1 && name[0] == 'h') ||
+      (name_len == 4 && memcmp(name, "help", 4) == 0)) {
+    t->kind = CLI_TOK_HELP;
+  }
+}
 
-        cli_err err = opt->parser(opt, argv[argv_i + 1]);
-        if (err != CLI_OK) {
-          return err;
-        }
-        argv_i += 2;
-      }
-    }
-    // check that we have seen all required opts
-    // if the parse broke early
-    if (!cli_opts_n_required_seen(opts)) {
-      return CLI_UNSEEN_REQ_OPTS;
+// the main parse state machine
+// tokens are pushed one at a time so a command line can be validated while it
+// is still arriving. cli_parse drives it over argv.
+
+typedef enum cli_mode {
+  CLI_MODE_OPTS = 0,  // reading options until the first positional or `--`
+  CLI_MODE_VALUE,     // the last option is waiting for its value token
+  CLI_MODE_ARGS       // everything else is positional
+} cli_mode;
+
+typedef struct cli_parser {
+  cli_mode mode;
+  cli_opt* pending;       // option waiting for its value in CLI_MODE_VALUE
+  size_t arg_i;           // next positional argument to fill
+  int idx;                // tokens fed so far, the argv index under cli_parse
+  const cli_opt* opt;     // option of the token being fed, if any
+  int err_idx;            // idx of the token that failed, -1 if none did
+  const char* err_token;  // the token that failed, as it was fed
+  size_t err_len;
+  const cli_opt* err_opt;  // option the failure is about, if any
+  const cli_constraint* violated;  // the constraint that failed, if any
+} cli_parser;
+
+void cli_parser_begin(cli_parser* p, cli_opts* opts) {
+  p->mode = CLI_MODE_OPTS;
+  p->pending = NULL;
+  p->arg_i = 0;
+  p->idx = 0;
+  p->opt = NULL;
+  p->err_idx = -1;
+  p->err_token = NULL;
+  p->err_len = 0;
+  p->err_opt = NULL;
+  p->violated = NULL;
+
+  // a command can be parsed more than once, and groups are shared
+  for (size_t g = 0; g <= opts->n_shared; g++) {
+    cli_opts* o = cli_opts_at(opts, g);
+    for (size_t i = 0; i < o->idx; i++) {
+      o->opts[i]->seen = false;
+      o->opts[i]->pending = false;
     }
   }
+}
 
-  if (args != NULL) {
-    // check that argc - the current argv i == the number of registered
-    // positional args
-    if ((argc - argv_i) != (int)(args->idx)) {
-      return CLI_ARG_COUNT;
-    }
+// leave option mode. all required options have to be seen by now.
+cli_err cli_parser_end_opts(cli_parser* p, cli_opts* opts) {
+  p->mode = CLI_MODE_ARGS;
+  if (!cli_opts_n_required_seen(opts)) {
+    return CLI_UNSEEN_REQ_OPTS;
+  }
+  return cli_opts_check_constraints(opts, &p->violated);
+}
+
+cli_err cli_parser_feed_arg(cli_parser* p,
+                            cli_args* args,
+                            const char* token,
+                            size_t len) {
+  if (p->arg_i == args->idx - (args->streamed ? 1 : 0)) {
+    return CLI_ARG_COUNT;
+  }
 
-    for (size_t i = 0; i < args->idx; i++, argv_i++) {
-      char* token = argv[argv_i];
-      cli_arg* arg = args->args[i];
+  // a variadic last argument keeps taking tokens
+  cli_arg* arg = args->args[p->arg_i];
+  if (!args->variadic || p->arg_i + 1 < args->idx) {
+    p->arg_i++;
+  }
+  arg->raw = token;
+  arg->raw_len = len;
+  return arg->parser(arg, token, len);
+}
 
-      cli_err err = arg->parser(arg, token);
+cli_err cli_parser_feed_opt(cli_parser* p,
+                            cli_opts* opts,
+                            cli_args* args,
+                            const char* token,
+                            const cli_tok* t) {
+  switch ((cli_tok_kind)t->kind) {
+    // an exact `--` ends the options, the token itself is dropped
+    case CLI_TOK_TERMINATOR:
+      return cli_parser_end_opts(p, opts);
+    // the first token without a dash prefix starts the positionals
+    case CLI_TOK_POSITIONAL: {
+      cli_err err = cli_parser_end_opts(p, opts);
       if (err != CLI_OK) {
         return err;
       }
+      return cli_parser_feed_arg(p, args, token, t->len);
     }
+    // short circuit the parse if we encounter help ... we immediately
+    // break out of the parse and should exit with the usage message
+    case CLI_TOK_HELP:
+      return CLI_PRINT_HELP_AND_EXIT;
+    case CLI_TOK_SHORT:
+    case CLI_TOK_LONG:
+      break;
   }
 
-  return CLI_OK;
-}
+  // split on the first = without copying, the token is left untouched
+  const char* name = token + t->dashes;
+  size_t end = t->eq != 0 ? t->eq : t->len;
+  size_t name_len = end - t->dashes;
 
-/// these are some default parsers ... these should always be called from the
+  cli_opt* opt;
+  cli_err err = cli_opts_lookup(opts, name, name_len, &opt);
+  if (err != CLI_OK) {
+    return err;
+  }
+  p->opt = opt;
 
-cli_err str_opt_parser(cli_opt* opt, const char* token) {
-  str_box* box = (str_box*)(opt->value);
+  // an abbreviation like `--he` can resolve to help as well. `--help=x` and
+  // `--he=x` stay what they always were, a flag that ignores its value.
+  if (t->eq == 0 && opt->name[name_len] != '\0' &&
+      strcmp(opt->name, "help") == 0) {
+    return CLI_PRINT_HELP_AND_EXIT;
+  }
 
-  size_t s = (sizeof(box->ptr) * box->sz) / sizeof(box->ptr);
-  if (s < strlen(token) + 1) {
-    return CLI_PARSE_FAILED_STR;
+  // check if we've seen this flag
+  if (opt->seen && !opt->repeatable) {
+    return CLI_ALREADY_SEEN;
   }
 
-  strncpy(box->ptr, token, box->sz);
-  return CLI_OK;
-}
+  // set the seen flag for the opt...
+  opt->seen = true;
 
-cli_err str_arg_parser(cli_arg* arg, const char* token) {
-  str_box* box = (str_box*)(arg->value);
+  if (opt->is_flag) {
+    return cli_opt_apply(opts, opt, NULL, 0);
+  }
 
-  size_t s = (sizeof(box->ptr) * box->sz) / sizeof(box->ptr);
-  if (s < strlen(token) + 1) {
-    return CLI_PARSE_FAILED_STR;
+  // we have a valid token like --data=42 split -> data, 42
+  if (t->eq != 0) {
+    return cli_opt_apply(opts, opt, token + end + 1, t->len - end - 1);
   }
 
-  strncpy(box->ptr, token, box->sz);
+  // otherwise the value is the next token
+  p->pending = opt;
+  p->mode = CLI_MODE_VALUE;
   return CLI_OK;
 }
 
-cli_err float_opt_parser(cli_opt* opt, const char* token) {
-  float* val = (float*)(opt->value);
-  char* endptr;
-  *val = (float)strtof(token, &endptr);
-  if (endptr == token) {
-    return CLI_PARSE_FAILED_FLOAT;
+// feed a token that has already been classified
+cli_err cli_parser_feed_tok(cli_parser* p,
+                            cli_opts* opts,
+                            cli_args* args,
+                            const char* token,
+                            const cli_tok* t) {
+  p->idx++;
+  p->opt = NULL;
+
+  cli_err err = CLI_OK;
+  switch (p->mode) {
+    case CLI_MODE_OPTS:
+      err = cli_parser_feed_opt(p, opts, args, token, t);
+      break;
+    case CLI_MODE_VALUE:
+      p->mode = CLI_MODE_OPTS;
+      p->opt = p->pending;
+      err = cli_opt_apply(opts, p->pending, token, t->len);
+      p->pending = NULL;
+      break;
+    case CLI_MODE_ARGS:
+      err = cli_parser_feed_arg(p, args, token, t->len);
+      break;
   }
-  return CLI_OK;
+
+  if (err != CLI_OK) {
+    p->err_idx = p->idx;
+    p->err_token = token;
+    p->err_len = t->len;
+    p->err_opt = p->opt;
+  }
+  return err;
 }
 
-cli_err float_arg_parser(cli_arg* arg, const char* token) {
-  float* val = (float*)(arg->value);
-  char* endptr;
-  *val = (float)strtof(token, &endptr);
-  if (endptr == token) {
-    return CLI_PARSE_FAILED_FLOAT;
+// classify a fed slice. the kind only matters while options are still
+// being read.
+void cli_parser_classify(const cli_parser* p,
+                         const char* token,
+                         size_t len,
+                         cli_tok* t) {
+  t->kind = CLI_TOK_POSITIONAL;
+  t->dashes = 0;
+  t->eq = 0;
+  t->len = len;
+  if (p->mode == CLI_MODE_OPTS) {
+    const char* eq = (const char*)memchr(token, '=', len);
+    cli_classify(token, len, eq == NULL ? len : (size_t)(eq - token), t);
   }
-  return CLI_OK;
 }
 
-cli_err int_opt_parser(cli_opt* opt, const char* token) {
-  int* val = (int*)(opt->value);
-  char* endptr;
-  *val = (int)strtol(token, &endptr, 10);
-  if (endptr == token) {
-    return CLI_PARSE_FAILED_INT;
+cli_err cli_parser_finish(cli_parser* p, cli_opts* opts, cli_args* args) {
+  // an option at the very end never got its value
+  if (p->mode == CLI_MODE_VALUE) {
+    p->err_opt = p->pending;
+    return CLI_OUT_OF_BOUNDS;
+  }
+
+  if (p->mode == CLI_MODE_OPTS) {
+    cli_err err = cli_parser_end_opts(p, opts);
+    if (err != CLI_OK) {
+      return err;
+    }
+  }
+
+  // every registered positional has to be filled, a variadic one may be empty
+  // and a streamed one comes later
+  if (p->arg_i != args->idx - (args->variadic || args->streamed ? 1 : 0)) {
+    return CLI_ARG_COUNT;
   }
   return CLI_OK;
 }
 
-cli_err int_arg_parser(cli_arg* arg, const char* token) {
-  int* val = (int*)(arg->value);
-  char* endptr;
-  *val = (int)strtol(token, &endptr, 10);
-  if (endptr == token) {
-    return CLI_PARSE_FAILED_INT;
+/// these are some default parsers ... these should always be called from the
+
+// fed tokens need not be NUL terminated, so numbers are copied out for the
+// libc converters. nothing this long is a valid number anyway.
+bool cli_token_cstr(const char* token, size_t len, char* buf) {
+  if (len + 1 > CLI_OPT_TOKEN_MAX_LEN) {
+    return false;
   }
-  return CLI_OK;
+  memcpy(buf, token, len);
+  buf[len] = '\0';
+  return true;
 }
 
-cli_err bool_opt_parser(cli_opt* opt, const char* arg) {
-  bool* val = (bool*)opt->value;
-  // most commonly handle a switch case like (--verbose) by passing null arg
-  if (arg == NULL) {
-    if (*val == true) {
-      *val = false;
-    } else {
-      *val = true;
+// UTF-8 validation
+// tokens are checked against the well formed byte ranges of the Unicode
+// standard (no overlongs, surrogates or code points past U+10FFFF). with
+// SSE2 that is done 16 bytes at a time, multi-byte sequences included, and
+// all ascii blocks cost one movemask. otherwise one sequence at a time.
+
+// length of the well formed sequence at the start of s[0..n), 0 if there is
+// none.
+size_t cli_utf8_seq(const unsigned char* s, size_t n) {
+  unsigned char c = s[0];
+  unsigned char lo = 0x80;  // range of the second byte
+  unsigned char hi = 0xbf;
+  size_t need;              // continuation bytes
+
+  if (c < 0x80) {
+    return 1;
+  } else if (c >= 0xc2 && c <= 0xdf) {
+    need = 1;
+  } else if (c == 0xe0) {
+    need = 2;
+    lo = 0xa0;
+  } else if (c == 0xed) {
+    need = 2;
+    hi = 0x9f;
+  } else if (c >= 0xe1 && c <= 0xef) {
+    need = 2;
+  } else if (c == 0xf0) {
+    need = 3;
+    lo = 0x90;
+  } else if (c == 0xf4) {
+    need = 3;
+    hi = 0x8f;
+  } else if (c >= 0xf1 && c <= 0xf3) {
+    need = 3;
+  } else {
+    return 0;
+  }
+
+  if (n <= need || s[1] < lo || s[1] > hi) {
+    return 0;
+  }
+  for (size_t k = 2; k <= need; k++) {
+    if (s[k] < 0x80 || s[k] > 0xbf) {
+      return 0;
     }
-    return CLI_OK;
   }
-  return CLI_PARSE_FAILED_BOOL;
+  return need + 1;
 }
 
-cli_err noop_parser(cli_opt* opt, const char* token) {
-  CLI_UNUSED(opt);
-  CLI_UNUSED(token);
-  return CLI_OK;
+#if defined(__SSE2__)
+// 0xff in every lane of `v` at or above `k`, unsigned
+__m128i cli_u8_ge(__m128i v, unsigned char k) {
+  return _mm_cmpeq_epi8(_mm_max_epu8(v, _mm_set1_epi8((char)k)), v);
 }
 
-// High level API
+// the block `cur` moved up by k lanes with the end of `prev` shifted in, so
+// lane i holds the byte k before it
+#define CLI_UTF8_BACK(cur, prev, k) \
+  _mm_or_si128(_mm_slli_si128(cur, k), _mm_srli_si128(prev, 16 - (k)))
 
-typedef struct cli_command {
-  const char* desc;
-  const char* usage;
-  cli_opts* opts;
-  cli_args* args;
-  int argc;
-  char** argv;
-  str_boxes* sb;
-} cli_command;
+// the lanes of `cur` that break a rule, given the block before it
+__m128i cli_utf8_block(__m128i cur, __m128i prev) {
+  __m128i back1 = CLI_UTF8_BACK(cur, prev, 1);
+  __m128i back2 = CLI_UTF8_BACK(cur, prev, 2);
+  __m128i back3 = CLI_UTF8_BACK(cur, prev, 3);
 
-cli_command* cli_command_new(void) {
-  cli_command* c = (cli_command*)malloc(sizeof(cli_command));
-  CLI_CHECK_MEM_ALLOC(c);
-  return c;
+  // c0, c1 and f5..ff never appear
+  __m128i err = _mm_or_si128(
+      cli_u8_ge(cur, 0xf5),
+      _mm_cmpeq_epi8(_mm_and_si128(cur, _mm_set1_epi8((char)0xfe)),
+                     _mm_set1_epi8((char)0xc0)));
+
+  // continuation bytes sit exactly where a lead up to three back wants one
+  __m128i want = _mm_or_si128(
+      cli_u8_ge(back1, 0xc0),
+      _mm_or_si128(cli_u8_ge(back2, 0xe0), cli_u8_ge(back3, 0xf0)));
+  __m128i cont = _mm_cmpeq_epi8(
+      _mm_and_si128(cur, _mm_set1_epi8((char)0xc0)), _mm_set1_epi8((char)0x80));
+  err = _mm_or_si128(err, _mm_xor_si128(want, cont));
+
+  // the narrower second byte after e0, ed, f0 and f4
+  __m128i ge_a0 = cli_u8_ge(cur, 0xa0);
+  __m128i ge_90 = cli_u8_ge(cur, 0x90);
+  __m128i lo = _mm_or_si128(
+      _mm_andnot_si128(ge_a0,
+                       _mm_cmpeq_epi8(back1, _mm_set1_epi8((char)0xe0))),
+      _mm_andnot_si128(ge_90,
+                       _mm_cmpeq_epi8(back1, _mm_set1_epi8((char)0xf0))));
+  __m128i hi = _mm_or_si128(
+      _mm_and_si128(ge_a0, _mm_cmpeq_epi8(back1, _mm_set1_epi8((char)0xed))),
+      _mm_and_si128(ge_90, _mm_cmpeq_epi8(back1, _mm_set1_epi8((char)0xf4))));
+  return _mm_or_si128(err, _mm_or_si128(lo, hi));
+}
+#endif
+
+bool cli_utf8_valid(const char* token, size_t len) {
+  const unsigned char* s = (const unsigned char*)token;
+#if defined(__SSE2__)
+  __m128i prev = _mm_setzero_si128();
+  __m128i err = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    __m128i cur = _mm_loadu_si128((const __m128i*)(s + i));
+    // ascii after ascii can't break a rule
+    if (_mm_movemask_epi8(_mm_or_si128(cur, prev)) != 0) {
+      err = _mm_or_si128(err, cli_utf8_block(cur, prev));
+    }
+    prev = cur;
+  }
+
+  // the tail is padded with NULs, then a block of NULs catches a sequence
+  // cut off at the end
+  unsigned char tail[16] = {0};
+  memcpy(tail, s + i, len - i);
+  __m128i cur = _mm_loadu_si128((const __m128i*)tail);
+  err = _mm_or_si128(err, cli_utf8_block(cur, prev));
+  err = _mm_or_si128(err, cli_utf8_block(_mm_setzero_si128(), cur));
+  return _mm_movemask_epi8(err) == 0;
+#else
+  size_t i = 0;
+  while (i < len) {
+    size_t n = cli_utf8_seq(s + i, len - i);
+    if (n == 0) {
+      return false;
+    }
+    i += n;
+  }
+  return true;
+#endif
+}
+
+// copy a token into a buffer of the box's size and UTF-8 rule
+cli_err cli_parse_str(const char* token,
+                      size_t len,
+                      const str_box* box,
+                      char* out) {
+  if (box->sz < len + 1) {
+    return CLI_PARSE_FAILED_STR;
+  }
+
+  if (box->utf8 && !cli_utf8_valid(token, len)) {
+    return CLI_PARSE_FAILED_UTF8;
+  }
+
+  memcpy(out, token, len);
+  out[len] = '\0';
+  return CLI_OK;
+}
+
+cli_err str_opt_parser(cli_opt* opt, const char* token, size_t len) {
+  str_box* box = (str_box*)(opt->value);
+  return cli_parse_str(token, len, box, box->ptr);
+}
+
+cli_err str_arg_parser(cli_arg* arg, const char* token, size_t len) {
+  str_box* box = (str_box*)(arg->value);
+  return cli_parse_str(token, len, box, box->ptr);
+}
+
+cli_err cli_parse_float(const char* token, size_t len, float* out) {
+  char buf[CLI_OPT_TOKEN_MAX_LEN];
+  if (!cli_token_cstr(token, len, buf)) {
+    return CLI_PARSE_FAILED_FLOAT;
+  }
+
+  char* endptr;
+  *out = (float)strtof(buf, &endptr);
+  if (endptr == buf) {
+    return CLI_PARSE_FAILED_FLOAT;
+  }
+  return CLI_OK;
+}
+
+cli_err float_opt_parser(cli_opt* opt, const char* token, size_t len) {
+  return cli_parse_float(token, len, (float*)(opt->value));
+}
+
+cli_err float_arg_parser(cli_arg* arg, const char* token, size_t len) {
+  return cli_parse_float(token, len, (float*)(arg->value));
+}
+
+cli_err cli_parse_int(const char* token, size_t len, int* out) {
+  char buf[CLI_OPT_TOKEN_MAX_LEN];
+  if (!cli_token_cstr(token, len, buf)) {
+    return CLI_PARSE_FAILED_INT;
+  }
+
+  char* endptr;
+  *out = (int)strtol(buf, &endptr, 10);
+  if (endptr == buf) {
+    return CLI_PARSE_FAILED_INT;
+  }
+  return CLI_OK;
+}
+
+cli_err int_opt_parser(cli_opt* opt, const char* token, size_t len) {
+  return cli_parse_int(token, len, (int*)(opt->value));
+}
+
+cli_err int_arg_parser(cli_arg* arg, const char* token, size_t len) {
+  return cli_parse_int(token, len, (int*)(arg->value));
+}
+
+cli_err choice_opt_parser(cli_opt* opt, const char* token, size_t len) {
+  choice_box* box = (choice_box*)(opt->value);
+  int slot = box->slots[choice_hash(token, len, box->seed) & box->mask];
+  if (slot == 0) {
+    return CLI_PARSE_FAILED_CHOICE;
+  }
+
+  const char* choice = box->choices[slot - 1];
+  if (strncmp(choice, token, len) != 0 || choice[len] != '\0') {
+    return CLI_PARSE_FAILED_CHOICE;
+  }
+  *box->out = slot - 1;
+  return CLI_OK;
+}
+
+// sizes and durations are a decimal number followed by a unit from a table.
+// the number is read once into integer and fraction parts so scaling by the
+// unit is exact integer math with overflow checks.
+
+static const uint64_t cli_pow10[] = {1,         10,         100,
+                                     1000,      10000,      100000,
+                                     1000000,   10000000,   100000000,
+                                     1000000000};
+
+// fraction digits past this are dropped, keeping the scaling below in range
+#define CLI_MAX_FRAC_DIGITS 9
+
+typedef struct cli_decimal {
+  uint64_t ip;    // integer part
+  uint64_t frac;  // fraction digits as an integer
+  size_t n_frac;  // number of fraction digits kept
+} cli_decimal;
+
+// read `[0-9]*(.[0-9]*)?` from s and return the bytes consumed, 0 if there
+// were no digits at all or the integer part overflowed.
+size_t cli_read_decimal(const char* s, size_t len, cli_decimal* d) {
+  size_t i = 0;
+  size_t n_digits = 0;
+  d->ip = 0;
+  d->frac = 0;
+  d->n_frac = 0;
+
+  for (; i < len && s[i] >= '0' && s[i] <= '9'; i++, n_digits++) {
+    uint64_t digit = (uint64_t)(s[i] - '0');
+    if (d->ip > (UINT64_MAX - digit) / 10) {
+      return 0;
+    }
+    d->ip = d->ip * 10 + digit;
+  }
+
+  if (i < len && s[i] == '.') {
+    for (i++; i < len && s[i] >= '0' && s[i] <= '9'; i++, n_digits++) {
+      if (d->n_frac < CLI_MAX_FRAC_DIGITS) {
+        d->frac = d->frac * 10 + (uint64_t)(s[i] - '0');
+        d->n_frac++;
+      }
+    }
+  }
+  return n_digits == 0 ? 0 : i;
+}
+
+// floor(d * mult) into out, false on overflow.
+// the fraction is split as frac * (q + r / 10^n) so no product can overflow.
+bool cli_decimal_scale(const cli_decimal* d, uint64_t mult, uint64_t* out) {
+  if (d->ip > UINT64_MAX / mult) {
+    return false;
+  }
+  uint64_t whole = d->ip * mult;
+
+  uint64_t p = cli_pow10[d->n_frac];
+  uint64_t part = d->frac * (mult / p) + d->frac * (mult % p) / p;
+  if (whole > UINT64_MAX - part) {
+    return false;
+  }
+  *out = whole + part;
+  return true;
+}
+
+// K, M, G... are powers of 1024 unless spelled KB, MB, GB (powers of 1000).
+// KiB, MiB, GiB are always powers of 1024.
+typedef struct size_unit {
+  char prefix;
+  uint64_t bin;
+  uint64_t dec;
+} size_unit;
+
+static const size_unit size_units[] = {
+    {'K', (uint64_t)1 << 10, 1000ull},
+    {'M', (uint64_t)1 << 20, 1000000ull},
+    {'G', (uint64_t)1 << 30, 1000000000ull},
+    {'T', (uint64_t)1 << 40, 1000000000000ull},
+    {'P', (uint64_t)1 << 50, 1000000000000000ull},
+    {'E', (uint64_t)1 << 60, 1000000000000000000ull},
+};
+
+cli_err cli_parse_size(const char* token, size_t len, uint64_t* out) {
+  cli_decimal d;
+  size_t i = cli_read_decimal(token, len, &d);
+  if (i == 0) {
+    return CLI_PARSE_FAILED_SIZE;
+  }
+
+  const char* unit = token + i;
+  size_t unit_len = len - i;
+  uint64_t mult = 1;
+
+  if (unit_len == 1 && (unit[0] == 'B' || unit[0] == 'b')) {
+    unit_len = 0;
+  }
+
+  if (unit_len > 0) {
+    const size_unit* u = NULL;
+    for (size_t k = 0; k < sizeof(size_units) / sizeof(size_unit); k++) {
+      if (size_units[k].prefix == (unit[0] & ~0x20)) {
+        u = &size_units[k];
+        break;
+      }
+    }
+    if (u == NULL) {
+      return CLI_PARSE_FAILED_SIZE;
+    }
+
+    // what follows the prefix is one of "", "B", "i", "iB"
+    const char* rest = unit + 1;
+    size_t rest_len = unit_len - 1;
+    if (rest_len == 0 || (rest_len == 1 && rest[0] == 'i') ||
+        (rest_len == 2 && rest[0] == 'i' && rest[1] == 'B')) {
+      mult = u->bin;
+    } else if (rest_len == 1 && rest[0] == 'B') {
+      mult = u->dec;
+    } else {
+      return CLI_PARSE_FAILED_SIZE;
+    }
+  }
+
+  if (!cli_decimal_scale(&d, mult, out)) {
+    return CLI_PARSE_FAILED_SIZE;
+  }
+  return CLI_OK;
+}
+
+typedef struct duration_unit {
+  const char* name;
+  size_t len;
+  uint64_t ns;
+} duration_unit;
+
+// longer names first so `ms` is not read as `m` followed by junk
+static const duration_unit duration_units[] = {
+    {"ns", 2, 1ull},
+    {"us", 2, 1000ull},
+    {"ms", 2, 1000000ull},
+    {"s", 1, 1000000000ull},
+    {"m", 1, 60000000000ull},
+    {"h", 1, 3600000000000ull},
+    {"d", 1, 86400000000000ull},
+};
+
+// one or more number+unit pairs like Go's time.ParseDuration: `250ms`,
+// `1h30m`, `-1.5s`. a bare `0` is the only value allowed without a unit.
+cli_err cli_parse_duration(const char* token, size_t len, int64_t* out) {
+  size_t i = 0;
+  bool neg = false;
+  if (i < len && (token[i] == '-' || token[i] == '+')) {
+    neg = token[i] == '-';
+    i++;
+  }
+
+  if (len - i == 1 && token[i] == '0') {
+    *out = 0;
+    return CLI_OK;
+  }
+
+  if (i == len) {
+    return CLI_PARSE_FAILED_DURATION;
+  }
+
+  uint64_t total = 0;
+  while (i < len) {
+    cli_decimal d;
+    size_t n = cli_read_decimal(token + i, len - i, &d);
+    if (n == 0) {
+      return CLI_PARSE_FAILED_DURATION;
+    }
+    i += n;
+
+    const duration_unit* u = NULL;
+    for (size_t k = 0; k < sizeof(duration_units) / sizeof(duration_unit);
+         k++) {
+      const duration_unit* cand = &duration_units[k];
+      if (len - i >= cand->len &&
+          strncmp(token + i, cand->name, cand->len) == 0) {
+        u = cand;
+        break;
+      }
+    }
+    if (u == NULL) {
+      return CLI_PARSE_FAILED_DURATION;
+    }
+    i += u->len;
+
+    uint64_t ns = 0;
+    if (!cli_decimal_scale(&d, u->ns, &ns) || total > UINT64_MAX - ns) {
+      return CLI_PARSE_FAILED_DURATION;
+    }
+    total += ns;
+  }
+
+  // the negative range has room for one more
+  if (total > (uint64_t)INT64_MAX + (neg ? 1 : 0)) {
+    return CLI_PARSE_FAILED_DURATION;
+  }
+  *out = neg ? (int64_t)(0 - total) : (int64_t)total;
+  return CLI_OK;
+}
+
+cli_err size_opt_parser(cli_opt* opt, const char* token, size_t len) {
+  return cli_parse_size(token, len, (uint64_t*)(opt->value));
+}
+
+cli_err duration_opt_parser(cli_opt* opt, const char* token, size_t len) {
+  return cli_parse_duration(token, len, (int64_t*)(opt->value));
+}
+
+// user supplied parsers decode straight into their own target
+typedef struct custom_box {
+  cli_custom_parser parser;
+  void* ctx;
+} custom_box;
+
+cli_err custom_opt_parser(cli_opt* opt, const char* token, size_t len) {
+  custom_box* box = (custom_box*)(opt->value);
+  return box->parser(token, len, box->ctx);
+}
+
+cli_err custom_arg_parser(cli_arg* arg, const char* token, size_t len) {
+  custom_box* box = (custom_box*)(arg->value);
+  return box->parser(token, len, box->ctx);
+}
+
+// paths are copied out of the token so they can be handed to stat(2) and
+// queued for the expectation checks that run once the parse finishes.
+typedef struct cli_path {
+  char* path;
+  unsigned expect;
+  int err;  // errno style reason once checked, 0 if it passed
+} cli_path;
+
+// every path of the current parse for one command
+typedef struct cli_paths {
+  cli_path* items;
+  size_t n;
+  size_t cap;
+  const char** rest;  // the variadic argument's paths in order
+  size_t n_rest;
+  size_t cap_rest;
+  const char*** rest_out;  // and where they are published
+  size_t* n_rest_out;
+  cli_path** bad;  // the failed checks of the last parse
+  size_t n_bad;
+} cli_paths;
+
+typedef struct path_box {
+  cli_paths* store;
+  unsigned expect;
+  const char** out;  // single path targets only
+} path_box;
+
+void cli_paths_init(cli_paths* store) {
+  memset(store, 0, sizeof(cli_paths));
+}
+
+void cli_paths_reset(cli_paths* store) {
+  for (size_t i = 0; i < store->n; i++) {
+    free(store->items[i].path);
+  }
+  store->n = 0;
+  store->n_rest = 0;
+  store->n_bad = 0;
+  if (store->n_rest_out != NULL) {
+    *store->rest_out = NULL;
+    *store->n_rest_out = 0;
+  }
+}
+
+void cli_paths_cleanup(cli_paths* store) {
+  cli_paths_reset(store);
+  free(store->items);
+  free(store->rest);
+  free(store->bad);
+}
+
+// a copy of the path owned by the store, NULL when out of memory
+const char* cli_paths_push(cli_paths* store,
+                           const char* token,
+                           size_t len,
+                           unsigned expect) {
+  if (store->n == store->cap) {
+    size_t cap = store->cap == 0 ? 8 : store->cap * 2;
+    cli_path* items = (cli_path*)realloc(store->items, cap * sizeof(cli_path));
+    if (items == NULL) {
+      return NULL;
+    }
+    store->items = items;
+    store->cap = cap;
+  }
+
+  char* path = (char*)malloc(len + 1);
+  if (path == NULL) {
+    return NULL;
+  }
+  memcpy(path, token, len);
+  path[len] = '\0';
+
+  cli_path* p = &store->items[store->n];
+  store->n++;
+  p->path = path;
+  p->expect = expect;
+  p->err = 0;
+  return path;
+}
+
+cli_err path_opt_parser(cli_opt* opt, const char* token, size_t len) {
+  path_box* box = (path_box*)(opt->value);
+  *box->out = cli_paths_push(box->store, token, len, box->expect);
+  return *box->out != NULL ? CLI_OK : CLI_OUT_OF_MEMORY;
+}
+
+cli_err path_arg_parser(cli_arg* arg, const char* token, size_t len) {
+  path_box* box = (path_box*)(arg->value);
+  *box->out = cli_paths_push(box->store, token, len, box->expect);
+  return *box->out != NULL ? CLI_OK : CLI_OUT_OF_MEMORY;
+}
+
+cli_err paths_arg_parser(cli_arg* arg, const char* token, size_t len) {
+  path_box* box = (path_box*)(arg->value);
+  cli_paths* store = box->store;
+
+  if (store->n_rest == store->cap_rest) {
+    size_t cap = store->cap_rest == 0 ? 8 : store->cap_rest * 2;
+    const char** rest =
+        (const char**)realloc((void*)store->rest, cap * sizeof(char*));
+    if (rest == NULL) {
+      return CLI_OUT_OF_MEMORY;
+    }
+    store->rest = rest;
+    store->cap_rest = cap;
+  }
+
+  const char* path = cli_paths_push(store, token, len, box->expect);
+  if (path == NULL) {
+    return CLI_OUT_OF_MEMORY;
+  }
+  store->rest[store->n_rest] = path;
+  store->n_rest++;
+  *store->rest_out = store->rest;
+  *store->n_rest_out = store->n_rest;
+  return CLI_OK;
+}
+
+// file contents are mapped for as long as the parse result lives. anything
+// that can't be mapped (pipes, ttys) is read into the heap instead.
+typedef struct cli_map {
+  void* addr;
+  size_t len;
+  bool mapped;  // munmap rather than free
+} cli_map;
+
+typedef struct cli_maps {
+  cli_map* items;
+  size_t n;
+  size_t cap;
+} cli_maps;
+
+typedef struct file_box {
+  cli_maps* store;
+  cli_span* out;
+} file_box;
+
+void cli_map_release(cli_map* m) {
+  if (m->mapped) {
+    munmap(m->addr, m->len);
+  } else {
+    free(m->addr);
+  }
+}
+
+void cli_maps_reset(cli_maps* store) {
+  for (size_t i = 0; i < store->n; i++) {
+    cli_map_release(&store->items[i]);
+  }
+  store->n = 0;
+}
+
+void cli_maps_cleanup(cli_maps* store) {
+  cli_maps_reset(store);
+  free(store->items);
+}
+
+bool cli_maps_push(cli_maps* store, cli_map m) {
+  if (store->n == store->cap) {
+    size_t cap = store->cap == 0 ? 4 : store->cap * 2;
+    cli_map* items = (cli_map*)realloc(store->items, cap * sizeof(cli_map));
+    if (items == NULL) {
+      return false;
+    }
+    store->items = items;
+    store->cap = cap;
+  }
+  store->items[store->n] = m;
+  store->n++;
+  return true;
+}
+
+// read a file that can't be mapped to the end
+cli_err cli_read_all(int fd, cli_map* m) {
+  size_t cap = 1 << 16;
+  char* buf = (char*)malloc(cap);
+  if (buf == NULL) {
+    return CLI_OUT_OF_MEMORY;
+  }
+
+  size_t len = 0;
+  for (;;) {
+    if (len == cap) {
+      cap *= 2;
+      char* grown = (char*)realloc(buf, cap);
+      if (grown == NULL) {
+        free(buf);
+        return CLI_OUT_OF_MEMORY;
+      }
+      buf = grown;
+    }
+    ssize_t got = read(fd, buf + len, cap - len);
+    if (got < 0 && errno == EINTR) {
+      continue;
+    }
+    if (got < 0) {
+      free(buf);
+      return CLI_PARSE_FAILED_FILE;
+    }
+    if (got == 0) {
+      break;
+    }
+    len += (size_t)got;
+  }
+
+  m->addr = buf;
+  m->len = len;
+  m->mapped = false;
+  return CLI_OK;
+}
+
+cli_err file_opt_parser(cli_opt* opt, const char* token, size_t len) {
+  file_box* box = (file_box*)(opt->value);
+
+  if (len > 0 && token[0] == '@') {
+    token++;
+    len--;
+  }
+  if (len == 0) {
+    return CLI_PARSE_FAILED_FILE;
+  }
+
+  char* path = (char*)malloc(len + 1);
+  if (path == NULL) {
+    return CLI_OUT_OF_MEMORY;
+  }
+  memcpy(path, token, len);
+  path[len] = '\0';
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  free(path);
+  if (fd < 0) {
+    return CLI_PARSE_FAILED_FILE;
+  }
+
+  struct stat st;
+  cli_map m = {NULL, 0, false};
+  cli_err err = fstat(fd, &st) == 0 ? CLI_OK : CLI_PARSE_FAILED_FILE;
+  if (err == CLI_OK && S_ISREG(st.st_mode)) {
+    m.len = (size_t)st.st_size;
+    if (m.len > 0) {
+      void* addr = mmap(NULL, m.len, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (addr == MAP_FAILED) {
+        err = CLI_PARSE_FAILED_FILE;
+      } else {
+        // only a hint, the pages come in on demand regardless
+        madvise(addr, m.len, MADV_WILLNEED);
+        m.addr = addr;
+        m.mapped = true;
+      }
+    }
+  } else if (err == CLI_OK) {
+    err = cli_read_all(fd, &m);
+  }
+  close(fd);
+
+  if (err != CLI_OK) {
+    return err;
+  }
+  if (m.addr != NULL && !cli_maps_push(box->store, m)) {
+    cli_map_release(&m);
+    return CLI_OUT_OF_MEMORY;
+  }
+
+  box->out->ptr = m.addr != NULL ? m.addr : "";
+  box->out->len = m.len;
+  return CLI_OK;
+}
+
+// range sets
+// `1,4,9-200` is read one item at a time and each item goes straight into a
+// bitset (whole words per step) or an interval array, never member by member.
+typedef struct range_box {
+  uint64_t* bits;     // bitset target
+  cli_range* ranges;  // or interval target
+  size_t cap;
+  size_t* n;
+  uint64_t limit;
+} range_box;
+
+// read a decimal u64 at token[*pos]
+bool cli_read_u64(const char* token, size_t len, size_t* pos, uint64_t* out) {
+  size_t i = *pos;
+  uint64_t v = 0;
+  for (; i < len && token[i] >= '0' && token[i] <= '9'; i++) {
+    uint64_t d = (uint64_t)(token[i] - '0');
+    if (v > (UINT64_MAX - d) / 10) {
+      return false;
+    }
+    v = v * 10 + d;
+  }
+  if (i == *pos) {
+    return false;
+  }
+  *pos = i;
+  *out = v;
+  return true;
+}
+
+// read the next `n` or `lo-hi` item and its trailing comma
+cli_err cli_next_range(const char* token,
+                       size_t len,
+                       size_t* pos,
+                       uint64_t limit,
+                       cli_range* r) {
+  if (!cli_read_u64(token, len, pos, &r->lo)) {
+    return CLI_PARSE_FAILED_RANGE;
+  }
+  r->hi = r->lo;
+  if (*pos < len && token[*pos] == '-') {
+    (*pos)++;
+    if (!cli_read_u64(token, len, pos, &r->hi) || r->hi < r->lo) {
+      return CLI_PARSE_FAILED_RANGE;
+    }
+  }
+  if (*pos < len) {
+    if (token[*pos] != ',' || *pos + 1 == len) {
+      return CLI_PARSE_FAILED_RANGE;
+    }
+    (*pos)++;
+  }
+  if (r->hi >= limit) {
+    return CLI_RANGE_OUT_OF_BOUNDS;
+  }
+  return CLI_OK;
+}
+
+cli_err bitset_opt_parser(cli_opt* opt, const char* token, size_t len) {
+  range_box* box = (range_box*)(opt->value);
+  memset(box->bits, 0, (size_t)((box->limit + 63) / 64) * sizeof(uint64_t));
+
+  size_t pos = 0;
+  do {
+    cli_range r;
+    cli_err err = cli_next_range(token, len, &pos, box->limit, &r);
+    if (err != CLI_OK) {
+      return err;
+    }
+
+    // every word the range touches, masked at both ends
+    for (uint64_t w = r.lo / 64; w <= r.hi / 64; w++) {
+      uint64_t mask = UINT64_MAX;
+      if (w == r.lo / 64) {
+        mask &= UINT64_MAX << (r.lo % 64);
+      }
+      if (w == r.hi / 64) {
+        mask &= UINT64_MAX >> (63 - r.hi % 64);
+      }
+      if (box->bits[w] & mask) {
+        return CLI_RANGE_OVERLAP;
+      }
+      box->bits[w] |= mask;
+    }
+  } while (pos < len);
+  return CLI_OK;
+}
+
+int cli_range_cmp(const void* a, const void* b) {
+  uint64_t x = ((const cli_range*)a)->lo;
+  uint64_t y = ((const cli_range*)b)->lo;
+  return (x > y) - (x < y);
+}
+
+// sort and merge adjacent intervals in place, fails on any overlap
+cli_err cli_ranges_merge(cli_range* ranges, size_t* n) {
+  if (*n == 0) {
+    return CLI_OK;
+  }
+  qsort(ranges, *n, sizeof(cli_range), cli_range_cmp);
+
+  size_t out = 0;
+  for (size_t i = 1; i < *n; i++) {
+    if (ranges[i].lo <= ranges[out].hi) {
+      return CLI_RANGE_OVERLAP;
+    }
+    if (ranges[i].lo == ranges[out].hi + 1) {
+      ranges[out].hi = ranges[i].hi;
+    } else {
+      ranges[++out] = ranges[i];
+    }
+  }
+  *n = out + 1;
+  return CLI_OK;
+}
+
+// grow an interval that `r` touches instead of taking a slot. the final
+// merge catches anything the grown interval now overlaps.
+cli_err cli_ranges_extend(cli_range* ranges, size_t n, cli_range r) {
+  for (size_t i = 0; i < n; i++) {
+    cli_range* x = &ranges[i];
+    if (r.lo <= x->hi && x->lo <= r.hi) {
+      return CLI_RANGE_OVERLAP;
+    }
+    if (r.lo == x->hi + 1) {
+      x->hi = r.hi;
+      return CLI_OK;
+    }
+    if (r.hi + 1 == x->lo) {
+      x->lo = r.lo;
+      return CLI_OK;
+    }
+  }
+  return CLI_RANGE_OUT_OF_BOUNDS;
+}
+
+cli_err ranges_opt_parser(cli_opt* opt, const char* token, size_t len) {
+  range_box* box = (range_box*)(opt->value);
+  size_t n = 0;
+
+  size_t pos = 0;
+  do {
+    cli_range r;
+    cli_err err = cli_next_range(token, len, &pos, box->limit, &r);
+    if (err != CLI_OK) {
+      return err;
+    }
+
+    // compact when full, so only the merged result has to fit
+    if (n == box->cap) {
+      err = cli_ranges_merge(box->ranges, &n);
+      if (err == CLI_OK && n == box->cap) {
+        err = cli_ranges_extend(box->ranges, n, r);
+        if (err == CLI_OK) {
+          continue;
+        }
+      }
+      if (err != CLI_OK) {
+        return err;
+      }
+    }
+    box->ranges[n++] = r;
+  } while (pos < len);
+
+  cli_err err = cli_ranges_merge(box->ranges, &n);
+  if (err != CLI_OK) {
+    return err;
+  }
+  *box->n = n;
+  return CLI_OK;
+}
+
+// key=value tables
+// open addressing with linear probing over a power of two slot array. slots
+// hold indexes into a dense entry array, which keeps first given order for
+// iteration. keys and values point into the fed tokens.
+typedef struct cli_kv_entry {
+  const char* key;
+  size_t key_len;
+  const char* value;
+  size_t value_len;
+  uint32_t hash;
+} cli_kv_entry;
+
+struct cli_kv {
+  cli_kv_entry* entries;
+  size_t n;
+  size_t cap;       // entries
+  uint32_t* slots;  // entry index + 1, 0 when empty
+  size_t mask;      // slot count - 1
+  cli_kv_policy policy;
+};
+
+// every table of a command, to be cleared each parse
+typedef struct cli_kvs {
+  cli_kv** items;
+  size_t n;
+  size_t cap;
+} cli_kvs;
+
+void cli_kv_clear(cli_kv* kv) {
+  kv->n = 0;
+  if (kv->slots != NULL) {
+    memset(kv->slots, 0, (kv->mask + 1) * sizeof(uint32_t));
+  }
+}
+
+void cli_kv_free(cli_kv* kv) {
+  free(kv->entries);
+  free(kv->slots);
+  free(kv);
+}
+
+// the slot holding `key`, or the empty slot where it would go
+size_t cli_kv_probe(const cli_kv* kv,
+                    const char* key,
+                    size_t len,
+                    uint32_t hash) {
+  size_t slot = hash & kv->mask;
+  for (;;) {
+    uint32_t e = kv->slots[slot];
+    if (e == 0) {
+      return slot;
+    }
+    const cli_kv_entry* entry = &kv->entries[e - 1];
+    if (entry->hash == hash && entry->key_len == len &&
+        memcmp(entry->key, key, len) == 0) {
+      return slot;
+    }
+    slot = (slot + 1) & kv->mask;
+  }
+}
+
+// keep the slots at most half full. on failure the table is left as it was.
+bool cli_kv_grow(cli_kv* kv) {
+  if (kv->n < kv->cap) {
+    return true;
+  }
+
+  size_t cap = kv->cap == 0 ? 8 : kv->cap * 2;
+  cli_kv_entry* entries =
+      (cli_kv_entry*)realloc(kv->entries, cap * sizeof(cli_kv_entry));
+  if (entries == NULL) {
+    return false;
+  }
+  kv->entries = entries;
+  uint32_t* slots = (uint32_t*)calloc(cap * 2, sizeof(uint32_t));
+  if (slots == NULL) {
+    return false;
+  }
+  kv->cap = cap;
+
+  free(kv->slots);
+  kv->slots = slots;
+  kv->mask = cap * 2 - 1;
+  for (size_t i = 0; i < kv->n; i++) {
+    const cli_kv_entry* e = &kv->entries[i];
+    kv->slots[cli_kv_probe(kv, e->key, e->key_len, e->hash)] = (uint32_t)i + 1;
+  }
+  return true;
+}
+
+cli_err kv_opt_parser(cli_opt* opt, const char* token, size_t len) {
+  cli_kv* kv = (cli_kv*)(opt->value);
+
+  const char* eq = (const char*)memchr(token, '=', len);
+  if (eq == NULL || eq == token) {
+    return CLI_PARSE_FAILED_KV;
+  }
+  size_t key_len = (size_t)(eq - token);
+  uint32_t hash = choice_hash(token, key_len, 0);
+
+  if (!cli_kv_grow(kv)) {
+    return CLI_OUT_OF_MEMORY;
+  }
+  size_t slot = cli_kv_probe(kv, token, key_len, hash);
+  cli_kv_entry* e;
+  if (kv->slots[slot] != 0) {
+    if (kv->policy == CLI_KV_UNIQUE) {
+      return CLI_DUPLICATE_KEY;
+    }
+    e = &kv->entries[kv->slots[slot] - 1];
+  } else {
+    e = &kv->entries[kv->n];
+    kv->n++;
+    kv->slots[slot] = (uint32_t)kv->n;
+    e->key = token;
+    e->key_len = key_len;
+    e->hash = hash;
+  }
+  e->value = eq + 1;
+  e->value_len = len - key_len - 1;
+  return CLI_OK;
+}
+
+bool cli_kv_get(const cli_kv* kv,
+                const char* key,
+                size_t len,
+                cli_span* value) {
+  if (kv->n == 0) {
+    return false;
+  }
+  uint32_t e = kv->slots[cli_kv_probe(kv, key, len, choice_hash(key, len, 0))];
+  if (e == 0) {
+    return false;
+  }
+  value->ptr = kv->entries[e - 1].value;
+  value->len = kv->entries[e - 1].value_len;
+  return true;
+}
+
+size_t cli_kv_count(const cli_kv* kv) {
+  return kv->n;
+}
+
+void cli_kv_at(const cli_kv* kv, size_t i, cli_span* key, cli_span* value) {
+  const cli_kv_entry* e = &kv->entries[i];
+  key->ptr = e->key;
+  key->len = e->key_len;
+  value->ptr = e->value;
+  value->len = e->value_len;
+}
+
+cli_err bool_opt_parser(cli_opt* opt, const char* arg, size_t len) {
+  CLI_UNUSED(len);
+  bool* val = (bool*)opt->value;
+  // most commonly handle a switch case like (--verbose) by passing null arg
+  if (arg == NULL) {
+    if (*val == true) {
+      *val = false;
+    } else {
+      *val = true;
+    }
+    return CLI_OK;
+  }
+  return CLI_PARSE_FAILED_BOOL;
+}
+
+cli_err noop_parser(cli_opt* opt, const char* token, size_t len) {
+  CLI_UNUSED(opt);
+  CLI_UNUSED(token);
+  CLI_UNUSED(len);
+  return CLI_OK;
+}
+
+// glob expansion
+// matched paths are fed as tokens, so every match is kept until the next
+// parse or cleanup.
+typedef struct cli_glob_list {
+  char** items;
+  size_t n;
+  size_t cap;
+} cli_glob_list;
+
+bool cli_glob_list_push(cli_glob_list* l, char* path) {
+  if (l->n == l->cap) {
+    size_t cap = l->cap == 0 ? 16 : l->cap * 2;
+    char** items = (char**)realloc((void*)l->items, cap * sizeof(char*));
+    if (items == NULL) {
+      return false;
+    }
+    l->items = items;
+    l->cap = cap;
+  }
+  l->items[l->n++] = path;
+  return true;
+}
+
+void cli_glob_list_reset(cli_glob_list* l) {
+  for (size_t i = 0; i < l->n; i++) {
+    free(l->items[i]);
+  }
+  l->n = 0;
+}
+
+void cli_glob_list_free(cli_glob_list* l) {
+  cli_glob_list_reset(l);
+  free((void*)l->items);
+  memset(l, 0, sizeof(cli_glob_list));
+}
+
+typedef struct cli_globs {
+  bool on;
+  cli_glob_list paths;  // every match of the current parse
+  size_t matches;       // paths matched in the current parse
+} cli_globs;
+
+void cli_globs_reset(cli_globs* globs) {
+  cli_glob_list_reset(&globs->paths);
+  globs->matches = 0;
+}
+
+void cli_globs_cleanup(cli_globs* globs) {
+  cli_glob_list_free(&globs->paths);
+}
+
+// streamed last argument
+
+typedef struct cli_stream {
+  int fd;
+  char delim;
+  cli_stream_cb cb;
+  void* ctx;
+  size_t n;  // records handed to cb in the current parse
+} cli_stream;
+
+// one record through the argument's parser and then the callback
+cli_err cli_stream_record(cli_stream* s,
+                          cli_arg* arg,
+                          const char* token,
+                          size_t len) {
+  if (len == 0) {
+    return CLI_OK;
+  }
+
+  arg->raw = token;
+  arg->raw_len = len;
+  cli_err err = arg->parser(arg, token, len);
+  if (err == CLI_OK) {
+    err = s->cb(s->ctx, s->n);
+  }
+  if (err == CLI_OK) {
+    s->n++;
+  }
+  return err;
+}
+
+// records are handled in place in one fixed buffer. the unfinished tail of a
+// read moves to the front before the next one, so a record can't be longer
+// than the buffer.
+cli_err cli_stream_run(cli_stream* s, cli_arg* arg) {
+  char* buf = (char*)malloc(CLI_STREAM_CHUNK);
+  if (buf == NULL) {
+    return CLI_OUT_OF_MEMORY;
+  }
+
+  s->n = 0;
+  size_t len = 0;
+  bool eof = false;
+  cli_err err = CLI_OK;
+  while (err == CLI_OK && !eof) {
+    ssize_t got = read(s->fd, buf + len, CLI_STREAM_CHUNK - len);
+    if (got < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      err = CLI_STREAM_FAILED;
+      break;
+    }
+    eof = got == 0;
+
+    // only the new bytes can hold a delimiter
+    size_t end = len + (size_t)got;
+    size_t start = 0;
+    const char* d;
+    while (err == CLI_OK &&
+           (d = memchr(buf + len, s->delim, end - len)) != NULL) {
+      size_t at = (size_t)(d - buf);
+      err = cli_stream_record(s, arg, buf + start, at - start);
+      start = at + 1;
+      len = start;
+    }
+    if (err == CLI_OK && eof) {
+      err = cli_stream_record(s, arg, buf + start, end - start);
+      start = end;
+    }
+
+    len = end - start;
+    memmove(buf, buf + start, len);
+    if (err == CLI_OK && len == CLI_STREAM_CHUNK) {
+      err = CLI_STREAM_RECORD_TOO_LONG;
+    }
+  }
+
+  // the argument must not keep a view into the buffer
+  arg->raw = NULL;
+  arg->raw_len = 0;
+  free(buf);
+  return err;
+}
+
+// struct binding
+// fields are ordinary options and arguments whose targets sit in the
+// defaults image. cli_parse_into converts straight into `cfg + offset`
+// instead, so nothing it does is visible to other callers.
+
+typedef struct cli_field {
+  cli_field_type type;
+  size_t offset;
+  size_t slot;         // own option index, or argument index
+  const str_box* str;  // buffer size and UTF-8 rule of a string field
+} cli_field;
+
+typedef struct cli_binding {
+  unsigned char* image;  // the defaults, copied into each struct first
+  size_t size;
+  cli_field fields[CLI_MAX_OPTS + CLI_MAX_ARGS];
+  size_t n;
+  pthread_mutex_t lock;  // building the option index on first use
+} cli_binding;
+
+void cli_binding_free(cli_binding* b) {
+  pthread_mutex_destroy(&b->lock);
+  free(b->image);
+  free(b);
+}
+
+// High level API
+
+typedef struct cli_command {
+  const char* desc;
+  const char* usage;
+  cli_opts* opts;
+  cli_args* args;
+  int argc;
+  char** argv;
+  str_boxes* sb;
+  cli_arena* arena;
+  cli_parser parser;  // state of the current or last parse
+  cli_err err;        // result of the last parse
+  int refs;           // owners of this command when it is used as a group
+  struct cli_command* groups[CLI_MAX_GROUPS];  // attached option groups
+  size_t n_groups;
+  cli_paths paths;  // path values of the current parse
+  cli_globs globs;  // expansions of the current parse
+  cli_values* defaults;  // option targets before the first parse
+  cli_maps maps;    // file contents of the current parse
+  cli_kvs kvs;      // key=value tables, cleared each parse
+  cli_stream stream;  // source of the streamed last argument
+  bool embedded;      // never print or exit, see cli_set_embedded
+  cli_binding* binding;  // fields of a bound struct, NULL if none
+} cli_command;
+
+cli_command* cli_command_try_new(void) {
+  cli_command* c = (cli_command*)malloc(sizeof(cli_command));
+  if (c != NULL) {
+    c->refs = 1;
+  }
+  return c;
+}
+
+cli_command* cli_command_new(void) {
+  cli_command* c = cli_command_try_new();
+  CLI_CHECK_MEM_ALLOC(c);
+  return c;
+}
+
+// everything but the help options, which a group must not bring along. on
+// failure whatever was allocated is still owned by the command for cleanup.
+cli_err cli_init_base(cli_command* cli,
+                      const char* desc,
+                      const char* usage,
+                      int argc,
+                      char** argv) {
+  cli->desc = desc;
+  cli->usage = usage;
+  cli->argc = argc;
+  cli->argv = argv;
+  cli->err = CLI_OK;
+  cli->n_groups = 0;
+  cli->embedded = false;
+  cli->binding = NULL;
+  cli->defaults = NULL;
+  cli_paths_init(&cli->paths);
+  memset(&cli->globs, 0, sizeof(cli_globs));
+  memset(&cli->maps, 0, sizeof(cli_maps));
+  memset(&cli->kvs, 0, sizeof(cli_kvs));
+  memset(&cli->stream, 0, sizeof(cli_stream));
+
+  cli->opts = (cli_opts*)calloc(1, sizeof(cli_opts));
+  cli->args = (cli_args*)calloc(1, sizeof(cli_args));
+  cli->sb = (str_boxes*)calloc(1, sizeof(str_boxes));
+  cli->arena = (cli_arena*)calloc(1, sizeof(cli_arena));
+  if (cli->opts == NULL || cli->args == NULL || cli->sb == NULL ||
+      cli->arena == NULL) {
+    return CLI_OUT_OF_MEMORY;
+  }
+
+  // if we have opts allocate the requested amount
+  bool ok = cli_opts_init(cli->opts, CLI_MAX_OPTS);
+  ok = cli_args_init(cli->args, CLI_MAX_ARGS) && ok;
+  // if every opt + arg is a string we would at most have MAX args and opts.
+  ok = str_boxes_init(cli->sb, CLI_MAX_ARGS + CLI_MAX_OPTS) && ok;
+  cli_arena_init(cli->arena);
+  return ok ? CLI_OK : CLI_OUT_OF_MEMORY;
+}
+
+cli_err cli_init(cli_command* cli,
+                 const char* desc,
+                 const char* usage,
+                 int argc,
+                 char** argv) {
+  cli_err err = cli_init_base(cli, desc, usage, argc, argv);
+  if (err != CLI_OK) {
+    return err;
+  }
+
+  // we should always allocate 2 for optional help message flag `-h, --help`
+  // help is really just used as token to break out of the parse.
+  // since we always add them we can simply print info to stderr later if -h or
+  // --help is raised.
+  err = cli_opts_add(cli->opts, "h", "", noop_parser, NULL, false, true);
+  if (err != CLI_OK) {
+    return err;
+  }
+  return cli_opts_add(cli->opts, "help", "", noop_parser, NULL, false, true);
+}
+
+cli_command* cli_group_new(void) {
+  cli_command* g = cli_command_try_new();
+  if (g == NULL) {
+    return NULL;
+  }
+  if (cli_init_base(g, "", "", 0, NULL) != CLI_OK) {
+    cli_command_destroy(g);
+    return NULL;
+  }
+  return g;
+}
+
+void cli_defaults_restore(cli_command* cli);
+
+cli_err cli_add_group(cli_command* cli, cli_command* group) {
+  if (cli->n_groups == CLI_MAX_GROUPS) {
+    return CLI_FULL_REGISTRY;
+  }
+  // either would leave a reference that is never released
+  if (group == cli) {
+    return CLI_BAD_GROUP;
+  }
+  for (size_t g = 0; g < cli->n_groups; g++) {
+    if (cli->groups[g] == group) {
+      return CLI_BAD_GROUP;
+    }
+  }
+
+  // the group index is built once here and shared from then on, and so are
+  // its defaults if no command has parsed it yet
+  cli_opts_build_index(group->opts);
+  if (group->defaults == NULL) {
+    cli_defaults_restore(group);
+  }
+  group->refs++;
+
+  cli->groups[cli->n_groups] = group;
+  cli->n_groups++;
+  cli->opts->shared[cli->opts->n_shared] = group->opts;
+  cli->opts->n_shared++;
+  return CLI_OK;
+}
+
+void cli_cleanup(cli_command* cli) {
+  // drop our reference on each attached group
+  for (; cli->n_groups > 0; cli->n_groups--) {
+    cli_command_destroy(cli->groups[cli->n_groups - 1]);
+  }
+
+  if (cli->opts != NULL) {
+    cli_opts_cleanup(cli->opts);
+    free(cli->opts);
+  }
+
+  if (cli->args != NULL) {
+    cli_args_cleanup(cli->args);
+    free(cli->args);
+  }
+
+  if (cli->sb != NULL) {
+    str_boxes_cleanup(cli->sb);
+    free(cli->sb);
+  }
+
+  if (cli->arena != NULL) {
+    cli_arena_cleanup(cli->arena);
+    free(cli->arena);
+  }
+
+  free(cli->defaults);
+  cli->defaults = NULL;
+  cli_paths_cleanup(&cli->paths);
+  cli_globs_cleanup(&cli->globs);
+  cli_maps_cleanup(&cli->maps);
+
+  for (size_t i = 0; i < cli->kvs.n; i++) {
+    cli_kv_free(cli->kvs.items[i]);
+  }
+  free(cli->kvs.items);
+
+  if (cli->binding != NULL) {
+    cli_binding_free(cli->binding);
+  }
+}
+
+void cli_command_destroy(cli_command* c) {
+  // a group lives until the last command using it is gone
+  c->refs--;
+  if (c->refs > 0) {
+    return;
+  }
+  cli_cleanup(c);
+  free(c);
+}
+
+void cli_allow_abbrev(cli_command* cli, bool allow) {
+  cli->opts->abbrev = allow;
+}
+
+void cli_set_lazy(cli_command* cli, bool lazy) {
+  cli->opts->lazy = lazy;
+}
+
+void cli_expand_globs(cli_command* cli, bool expand) {
+  cli->globs.on = expand;
+}
+
+void cli_require_utf8(cli_command* cli, bool require) {
+  cli->sb->utf8 = require;
+  for (size_t i = 0; i < cli->sb->idx; i++) {
+    cli->sb->arr[i]->utf8 = require;
+  }
+}
+
+// constraints API
+
+// "<head>--a, --b<tail>" in the arena
+const char* cli_constraint_desc(cli_arena* arena,
+                                const char* head,
+                                const char* const* names,
+                                size_t n,
+                                const char* tail) {
+  size_t cap = strlen(head) + strlen(tail) + 1;
+  for (size_t k = 0; k < n; k++) {
+    cap += strlen(names[k]) + 4;
+  }
+
+  char* desc = (char*)cli_arena_alloc(arena, cap);
+  if (desc == NULL) {
+    return NULL;
+  }
+  size_t len = (size_t)snprintf(desc, cap, "%s", head);
+  for (size_t k = 0; k < n; k++) {
+    len += (size_t)snprintf(desc + len, cap - len, "%s--%s",
+                            k == 0 ? "" : ", ", names[k]);
+  }
+  snprintf(desc + len, cap - len, "%s", tail);
+  return desc;
+}
+
+// compile the masks, then describe the constraint as "<head>names<tail>"
+// where names are the needs of a requires and the members otherwise.
+cli_err cli_add_constraint(cli_command* cli,
+                           cli_rule rule,
+                           const char* const* members,
+                           size_t n_members,
+                           const char* const* needs,
+                           size_t n_needs,
+                           const char* head,
+                           const char* tail) {
+  cli_constraint c = {.rule = rule, .desc = NULL, .next = NULL};
+  cli_err err = cli_opts_mask(cli->opts, members, n_members, c.members);
+  if (err != CLI_OK) {
+    return err;
+  }
+  if (rule == CLI_RULE_REQUIRES) {
+    err = cli_opts_mask(cli->opts, needs, n_needs, c.needs);
+    if (err != CLI_OK) {
+      return err;
+    }
+  } else {
+    needs = members;
+    n_needs = n_members;
+  }
+  c.desc = cli_constraint_desc(cli->arena, head, needs, n_needs, tail);
+
+  cli_constraint* stored =
+      (cli_constraint*)cli_arena_alloc(cli->arena, sizeof(cli_constraint));
+  if (c.desc == NULL || stored == NULL) {
+    return CLI_OUT_OF_MEMORY;
+  }
+  *stored = c;
+
+  cli_opts* opts = cli->opts;
+  if (opts->last_constraint == NULL) {
+    opts->constraints = stored;
+  } else {
+    opts->last_constraint->next = stored;
+  }
+  opts->last_constraint = stored;
+  return CLI_OK;
+}
+
+cli_err cli_add_exclusive(cli_command* cli,
+                          const char* const* names,
+                          size_t n) {
+  return cli_add_constraint(cli, CLI_RULE_EXCLUSIVE, names, n, NULL, 0, "",
+                            " are mutually exclusive");
+}
+
+cli_err cli_add_requires(cli_command* cli,
+                         const char* name,
+                         const char* const* needs,
+                         size_t n) {
+  char head[CLI_OPT_TOKEN_MAX_LEN + 16] = "";
+  if (name != NULL) {
+    snprintf(head, sizeof(head), "--%s requires ", name);
+  }
+  return cli_add_constraint(cli, CLI_RULE_REQUIRES, &name, 1, needs, n, head,
+                            "");
+}
+
+cli_err cli_add_one_of(cli_command* cli, const char* const* names, size_t n) {
+  return cli_add_constraint(cli, CLI_RULE_ONE_OF, names, n, NULL, 0, "one of ",
+                            " is required");
+}
+
+const char* cli_violated_constraint(cli_command* cli) {
+  return cli->parser.violated == NULL ? NULL : cli->parser.violated->desc;
+}
+
+// high level API for adding options and arguments
+
+cli_err cli_add_flag(cli_command* cli,
+                     const char* name,
+                     const char* usage,
+                     bool* value) {
+  return cli_opts_add(cli->opts, name, usage, bool_opt_parser, (void*)value,
+                      false, true);
+}
+
+cli_err cli_add_int_argument(cli_command* cli, int* value) {
+  return cli_args_add(cli->args, int_arg_parser, (void*)value);
+}
+
+cli_err cli_add_int_option(cli_command* cli,
+                           const char* name,
+                           const char* usage,
+                           int* value,
+                           bool required) {
+  return cli_opts_add(cli->opts, name, usage, int_opt_parser, (void*)value,
+                      required, false);
+}
+
+cli_err cli_add_float_argument(cli_command* cli, float* value) {
+  return cli_args_add(cli->args, float_arg_parser, (void*)value);
+}
+
+cli_err cli_add_float_option(cli_command* cli,
+                             const char* name,
+                             const char* usage,
+                             float* value,
+                             bool required) {
+  return cli_opts_add(cli->opts, name, usage, float_opt_parser, (void*)value,
+                      required, false);
+}
+
+cli_err cli_add_str_argument(cli_command* cli, char* value, size_t buf_size) {
+  cli_err err;
+  str_box* box = NULL;
+
+  if ((err = str_boxes_add(cli->sb, value, buf_size, &box)) != CLI_OK) {
+    return err;
+  }
+
+  return cli_args_add(cli->args, str_arg_parser, (void*)box);
+}
+
+cli_err cli_add_str_option(cli_command* cli,
+                           const char* name,
+                           const char* usage,
+                           char* value,
+                           bool required,
+                           size_t buf_size) {
+  cli_err err;
+  str_box* box = NULL;
+
+  if ((err = str_boxes_add(cli->sb, value, buf_size, &box)) != CLI_OK) {
+    return err;
+  }
+
+  return cli_opts_add(cli->opts, name, usage, str_opt_parser, (void*)box,
+                      required, false);
+}
+
+cli_err cli_add_choice_option(cli_command* cli,
+                              const char* name,
+                              const char* usage,
+                              const char* const* choices,
+                              size_t n,
+                              int* value,
+                              bool required) {
+  // nothing could ever match an empty set, and a repeated choice would
+  // collide under every seed
+  if (n == 0) {
+    return CLI_BAD_CHOICES;
+  }
+  for (size_t i = 0; i < n; i++) {
+    for (size_t j = i + 1; j < n; j++) {
+      if (strcmp(choices[i], choices[j]) == 0) {
+        return CLI_BAD_CHOICES;
+      }
+    }
+  }
+
+  // start at a load factor of 1/2 and grow the table if no seed works
+  size_t sz = 4;
+  while (sz < n * 2) {
+    sz *= 2;
+  }
+
+  choice_box* box = NULL;
+  for (bool placed = false; !placed; sz *= 2) {
+    box = (choice_box*)cli_arena_alloc(cli->arena,
+                                       sizeof(choice_box) + sz * sizeof(int));
+    if (box == NULL) {
+      return CLI_OUT_OF_MEMORY;
+    }
+    box->out = value;
+    box->choices = choices;
+    box->n = n;
+    box->mask = sz - 1;
+    for (uint32_t seed = 0; seed < 64 && !placed; seed++) {
+      placed = choice_box_fill(box, seed);
+    }
+  }
+
+  return cli_opts_add(cli->opts, name, usage, choice_opt_parser, (void*)box,
+                      required, false);
+}
+
+cli_err cli_add_size_option(cli_command* cli,
+                            const char* name,
+                            const char* usage,
+                            uint64_t* value,
+                            bool required) {
+  return cli_opts_add(cli->opts, name, usage, size_opt_parser, (void*)value,
+                      required, false);
+}
+
+cli_err cli_add_duration_option(cli_command* cli,
+                                const char* name,
+                                const char* usage,
+                                int64_t* value,
+                                bool required) {
+  return cli_opts_add(cli->opts, name, usage, duration_opt_parser,
+                      (void*)value, required, false);
+}
+
+cli_err cli_add_custom_option(cli_command* cli,
+                              const char* name,
+                              const char* usage,
+                              cli_custom_parser parser,
+                              void* ctx,
+                              bool required) {
+  custom_box* box =
+      (custom_box*)cli_arena_alloc(cli->arena, sizeof(custom_box));
+  if (box == NULL) {
+    return CLI_OUT_OF_MEMORY;
+  }
+  box->parser = parser;
+  box->ctx = ctx;
+
+  return cli_opts_add(cli->opts, name, usage, custom_opt_parser, (void*)box,
+                      required, false);
+}
+
+cli_err cli_add_custom_argument(cli_command* cli,
+                                cli_custom_parser parser,
+                                void* ctx) {
+  custom_box* box =
+      (custom_box*)cli_arena_alloc(cli->arena, sizeof(custom_box));
+  if (box == NULL) {
+    return CLI_OUT_OF_MEMORY;
+  }
+  box->parser = parser;
+  box->ctx = ctx;
+
+  return cli_args_add(cli->args, custom_arg_parser, (void*)box);
+}
+
+cli_err cli_add_file_option(cli_command* cli,
+                            const char* name,
+                            const char* usage,
+                            cli_span* value,
+                            bool required) {
+  file_box* box = (file_box*)cli_arena_alloc(cli->arena, sizeof(file_box));
+  if (box == NULL) {
+    return CLI_OUT_OF_MEMORY;
+  }
+  box->store = &cli->maps;
+  box->out = value;
+
+  return cli_opts_add(cli->opts, name, usage, file_opt_parser, (void*)box,
+                      required, false);
+}
+
+cli_err cli_add_kv_option(cli_command* cli,
+                          const char* name,
+                          const char* usage,
+                          const cli_kv** table,
+                          cli_kv_policy policy,
+                          bool required) {
+  cli_kvs* kvs = &cli->kvs;
+  if (kvs->n == kvs->cap) {
+    size_t cap = kvs->cap == 0 ? 4 : kvs->cap * 2;
+    cli_kv** items = (cli_kv**)realloc(kvs->items, cap * sizeof(cli_kv*));
+    if (items == NULL) {
+      return CLI_OUT_OF_MEMORY;
+    }
+    kvs->items = items;
+    kvs->cap = cap;
+  }
+
+  cli_kv* kv = (cli_kv*)calloc(1, sizeof(cli_kv));
+  if (kv == NULL) {
+    return CLI_OUT_OF_MEMORY;
+  }
+  kv->policy = policy;
+
+  cli_err err = cli_opts_add(cli->opts, name, usage, kv_opt_parser, (void*)kv,
+                             required, false);
+  if (err != CLI_OK) {
+    free(kv);
+    return err;
+  }
+  cli->opts->opts[cli->opts->idx - 1]->repeatable = true;
+
+  kvs->items[kvs->n] = kv;
+  kvs->n++;
+  *table = kv;
+  return CLI_OK;
+}
+
+cli_err cli_add_bitset_option(cli_command* cli,
+                              const char* name,
+                              const char* usage,
+                              uint64_t* bits,
+                              uint64_t limit,
+                              bool required) {
+  range_box* box = (range_box*)cli_arena_alloc(cli->arena, sizeof(range_box));
+  if (box == NULL) {
+    return CLI_OUT_OF_MEMORY;
+  }
+  box->bits = bits;
+  box->limit = limit;
+
+  return cli_opts_add(cli->opts, name, usage, bitset_opt_parser, (void*)box,
+                      required, false);
+}
+
+cli_err cli_add_ranges_option(cli_command* cli,
+                              const char* name,
+                              const char* usage,
+                              cli_range* ranges,
+                              size_t cap,
+                              size_t* n,
+                              uint64_t limit,
+                              bool required) {
+  range_box* box = (range_box*)cli_arena_alloc(cli->arena, sizeof(range_box));
+  if (box == NULL) {
+    return CLI_OUT_OF_MEMORY;
+  }
+  box->ranges = ranges;
+  box->cap = cap;
+  box->n = n;
+  box->limit = limit;
+
+  return cli_opts_add(cli->opts, name, usage, ranges_opt_parser, (void*)box,
+                      required, false);
+}
+
+path_box* cli_path_box_new(cli_command* cli, unsigned expect) {
+  path_box* box = (path_box*)cli_arena_alloc(cli->arena, sizeof(path_box));
+  if (box != NULL) {
+    box->store = &cli->paths;
+    box->expect = expect;
+  }
+  return box;
+}
+
+cli_err cli_add_path_option(cli_command* cli,
+                            const char* name,
+                            const char* usage,
+                            const char** value,
+                            unsigned expect,
+                            bool required) {
+  path_box* box = cli_path_box_new(cli, expect);
+  if (box == NULL) {
+    return CLI_OUT_OF_MEMORY;
+  }
+  box->out = value;
+
+  return cli_opts_add(cli->opts, name, usage, path_opt_parser, (void*)box,
+                      required, false);
+}
+
+cli_err cli_add_path_argument(cli_command* cli,
+                              const char** value,
+                              unsigned expect) {
+  path_box* box = cli_path_box_new(cli, expect);
+  if (box == NULL) {
+    return CLI_OUT_OF_MEMORY;
+  }
+  box->out = value;
+
+  return cli_args_add(cli->args, path_arg_parser, (void*)box);
+}
+
+cli_err cli_add_path_arguments(cli_command* cli,
+                               const char*** values,
+                               size_t* n,
+                               unsigned expect) {
+  path_box* box = cli_path_box_new(cli, expect);
+  if (box == NULL) {
+    return CLI_OUT_OF_MEMORY;
+  }
+
+  cli_err err = cli_args_add(cli->args, paths_arg_parser, (void*)box);
+  if (err != CLI_OK) {
+    return err;
+  }
+
+  cli->args->variadic = true;
+  cli->paths.rest_out = values;
+  cli->paths.n_rest_out = n;
+  *values = NULL;
+  *n = 0;
+  return CLI_OK;
+}
+
+cli_err cli_stream_arguments(cli_command* cli,
+                             int fd,
+                             char delim,
+                             cli_stream_cb cb,
+                             void* ctx) {
+  cli_args* args = cli->args;
+  if (args->idx == 0 || args->variadic || args->streamed) {
+    return CLI_ARG_COUNT;
+  }
+
+  // a path would stay in the path store for the whole stream
+  cli_arg_parser parser = args->args[args->idx - 1]->parser;
+  if (parser == path_arg_parser) {
+    return CLI_TYPE_MISMATCH;
+  }
+
+  args->streamed = true;
+  cli->stream.fd = fd;
+  cli->stream.delim = delim;
+  cli->stream.cb = cb;
+  cli->stream.ctx = ctx;
+  return CLI_OK;
+}
+
+size_t cli_streamed(cli_command* cli) {
+  return cli->stream.n;
+}
+
+cli_err cli_bind_struct(cli_command* cli, const void* defaults, size_t size) {
+  if (cli->binding != NULL) {
+    return CLI_ALREADY_BOUND;
+  }
+
+  cli_binding* b = (cli_binding*)malloc(sizeof(cli_binding));
+  unsigned char* image = (unsigned char*)malloc(size > 0 ? size : 1);
+  if (b == NULL || image == NULL) {
+    free(b);
+    free(image);
+    return CLI_OUT_OF_MEMORY;
+  }
+
+  if (pthread_mutex_init(&b->lock, NULL) != 0) {
+    free(b);
+    free(image);
+    return CLI_OUT_OF_MEMORY;
+  }
+
+  memcpy(image, defaults, size);
+  b->image = image;
+  b->size = size;
+  b->n = 0;
+  cli->binding = b;
+  return CLI_OK;
+}
+
+// the size a field of `type` has to have, 0 for strings which take any
+size_t cli_field_size(cli_field_type type) {
+  switch (type) {
+    case CLI_FIELD_FLAG:
+      return sizeof(bool);
+    case CLI_FIELD_INT:
+      return sizeof(int);
+    case CLI_FIELD_FLOAT:
+      return sizeof(float);
+    case CLI_FIELD_SIZE:
+      return sizeof(uint64_t);
+    case CLI_FIELD_DURATION:
+      return sizeof(int64_t);
+    case CLI_FIELD_STR:
+      break;
+  }
+  return 0;
+}
+
+// a field has to fit in the bound struct and have its type's size
+cli_err cli_field_check(cli_command* cli,
+                        cli_field_type type,
+                        size_t offset,
+                        size_t size) {
+  cli_binding* b = cli->binding;
+  if (b == NULL) {
+    return CLI_NOT_BOUND;
+  }
+  if (offset > b->size || size > b->size - offset) {
+    return CLI_OUT_OF_BOUNDS;
+  }
+
+  size_t want = cli_field_size(type);
+  if (size == 0 || (want != 0 && size != want)) {
+    return CLI_TYPE_MISMATCH;
+  }
+  return CLI_OK;
+}
+
+// record a field and return its 1 based index for the option or argument
+size_t cli_field_push(cli_binding* b,
+                      cli_field_type type,
+                      size_t offset,
+                      size_t slot,
+                      const void* value) {
+  cli_field* f = &b->fields[b->n];
+  f->type = type;
+  f->offset = offset;
+  f->slot = slot;
+  f->str = type == CLI_FIELD_STR ? (const str_box*)value : NULL;
+  b->n++;
+  return b->n;
+}
+
+cli_err cli_add_field_option(cli_command* cli,
+                             const char* name,
+                             const char* usage,
+                             cli_field_type type,
+                             size_t offset,
+                             size_t size,
+                             bool required) {
+  cli_err err = cli_field_check(cli, type, offset, size);
+  if (err != CLI_OK) {
+    return err;
+  }
+
+  void* target = cli->binding->image + offset;
+  switch (type) {
+    case CLI_FIELD_FLAG:
+      err = cli_add_flag(cli, name, usage, (bool*)target);
+      break;
+    case CLI_FIELD_INT:
+      err = cli_add_int_option(cli, name, usage, (int*)target, required);
+      break;
+    case CLI_FIELD_FLOAT:
+      err = cli_add_float_option(cli, name, usage, (float*)target, required);
+      break;
+    case CLI_FIELD_STR:
+      err = cli_add_str_option(cli, name, usage, (char*)target, required,
+                               size);
+      break;
+    case CLI_FIELD_SIZE:
+      err = cli_add_size_option(cli, name, usage, (uint64_t*)target, required);
+      break;
+    case CLI_FIELD_DURATION:
+      err = cli_add_duration_option(cli, name, usage, (int64_t*)target,
+                                    required);
+      break;
+  }
+  if (err != CLI_OK) {
+    return err;
+  }
+
+  size_t slot = cli->opts->idx - 1;
+  cli_opt* opt = cli->opts->opts[slot];
+  opt->field = cli_field_push(cli->binding, type, offset, slot, opt->value);
+  return CLI_OK;
+}
+
+cli_err cli_add_field_argument(cli_command* cli,
+                               cli_field_type type,
+                               size_t offset,
+                               size_t size) {
+  cli_err err = cli_field_check(cli, type, offset, size);
+  if (err != CLI_OK) {
+    return err;
+  }
+
+  void* target = cli->binding->image + offset;
+  switch (type) {
+    case CLI_FIELD_INT:
+      err = cli_add_int_argument(cli, (int*)target);
+      break;
+    case CLI_FIELD_FLOAT:
+      err = cli_add_float_argument(cli, (float*)target);
+      break;
+    case CLI_FIELD_STR:
+      err = cli_add_str_argument(cli, (char*)target, size);
+      break;
+    default:
+      return CLI_TYPE_MISMATCH;
+  }
+  if (err != CLI_OK) {
+    return err;
+  }
+
+  size_t slot = cli->args->idx - 1;
+  cli_arg* arg = cli->args->args[slot];
+  arg->field = cli_field_push(cli->binding, type, offset, slot, arg->value);
+  return CLI_OK;
+}
+
+// lazy getters
+
+// find `name`, check it was registered with `parser` and convert any pending
+// token into its target.
+cli_err cli_get_opt(cli_command* cli,
+                    const char* name,
+                    cli_opt_parser parser,
+                    cli_opt** out) {
+  cli_opt* opt = cli_opts_find(cli->opts, name);
+  if (opt == NULL) {
+    return CLI_NOT_FOUND;
+  }
+  if (opt->parser != parser) {
+    return CLI_TYPE_MISMATCH;
+  }
+  *out = opt;
+  return cli_opt_resolve(opt);
+}
+
+cli_err cli_get_flag(cli_command* cli, const char* name, bool* out) {
+  cli_opt* opt;
+  cli_err err = cli_get_opt(cli, name, bool_opt_parser, &opt);
+  if (err == CLI_OK) {
+    *out = *(bool*)(opt->value);
+  }
+  return err;
+}
+
+cli_err cli_get_int(cli_command* cli, const char* name, int* out) {
+  cli_opt* opt;
+  cli_err err = cli_get_opt(cli, name, int_opt_parser, &opt);
+  if (err == CLI_OK) {
+    *out = *(int*)(opt->value);
+  }
+  return err;
+}
+
+cli_err cli_get_float(cli_command* cli, const char* name, float* out) {
+  cli_opt* opt;
+  cli_err err = cli_get_opt(cli, name, float_opt_parser, &opt);
+  if (err == CLI_OK) {
+    *out = *(float*)(opt->value);
+  }
+  return err;
+}
+
+cli_err cli_get_str(cli_command* cli, const char* name, const char** out) {
+  cli_opt* opt;
+  cli_err err = cli_get_opt(cli, name, str_opt_parser, &opt);
+  if (err == CLI_OK) {
+    *out = ((str_box*)(opt->value))->ptr;
+  }
+  return err;
+}
+
+cli_err cli_resolve(cli_command* cli, const char* name) {
+  cli_opt* opt = cli_opts_find(cli->opts, name);
+  if (opt == NULL) {
+    return CLI_NOT_FOUND;
+  }
+  return cli_opt_resolve(opt);
+}
+
+// worker pool
+// a batch of independent jobs is spread over short lived threads that claim
+// the next index from a shared counter until the batch is drained.
+
+typedef void (*cli_job)(void* ctx, size_t i);
+
+typedef struct cli_pool {
+  cli_job job;
+  void* ctx;
+  size_t n;
+  atomic_size_t next;  // next job to claim
+} cli_pool;
+
+void* cli_pool_worker(void* arg) {
+  cli_pool* pool = (cli_pool*)arg;
+  for (;;) {
+    size_t i = atomic_fetch_add(&pool->next, 1);
+    if (i >= pool->n) {
+      return NULL;
+    }
+    pool->job(pool->ctx, i);
+  }
+}
+
+// run job(ctx, i) for every i < n on up to n_threads threads including the
+// caller, and return once all of them are done. if a thread can't be started
+// the others pick up its share.
+void cli_pool_run(cli_job job, void* ctx, size_t n, size_t n_threads) {
+  cli_pool pool = {.job = job, .ctx = ctx, .n = n};
+  atomic_init(&pool.next, 0);
+
+  if (n_threads > n) {
+    n_threads = n;
+  }
+
+  size_t started = 0;
+  pthread_t* threads = NULL;
+  // without memory for the handles the calling thread does all the work
+  if (n_threads > 1) {
+    threads = (pthread_t*)malloc((n_threads - 1) * sizeof(pthread_t));
+  }
+  if (threads != NULL) {
+    for (; started < n_threads - 1; started++) {
+      if (pthread_create(&threads[started], NULL, cli_pool_worker, &pool)) {
+        break;
+      }
+    }
+  }
+
+  cli_pool_worker(&pool);
+
+  for (size_t t = 0; t < started; t++) {
+    pthread_join(threads[t], NULL);
+  }
+  free(threads);
+}
+
+// path checks
+// every path given in a parse is checked in one batch once the parse is done,
+// so a user sees all the bad paths at once instead of one per attempt.
+
+// paths per thread before another one is worth starting
+#define CLI_PATHS_PER_THREAD 64
+
+// the file type bits of `path`, or -1 with errno set. statx asks for the
+// type alone, which spares filesystems like nfs from fetching the rest of
+// the inode; kernels or sandboxes without it fall back to stat.
+int cli_path_mode(const char* path, mode_t* mode) {
+#if defined(STATX_TYPE)
+  struct statx stx;
+  if (statx(AT_FDCWD, path, 0, STATX_TYPE, &stx) == 0) {
+    *mode = stx.stx_mode;
+    return 0;
+  }
+  if (errno != ENOSYS) {
+    return -1;
+  }
+#endif
+  struct stat st;
+  if (stat(path, &st) != 0) {
+    return -1;
+  }
+  *mode = st.st_mode;
+  return 0;
+}
+
+void cli_path_check(void* ctx, size_t i) {
+  cli_path* p = ((cli_path**)ctx)[i];
+  p->err = 0;
+
+  if (p->expect & (CLI_PATH_EXISTS | CLI_PATH_FILE | CLI_PATH_DIR)) {
+    mode_t mode;
+    if (cli_path_mode(p->path, &mode) != 0) {
+      p->err = errno;
+      return;
+    }
+    if ((p->expect & CLI_PATH_FILE) && !S_ISREG(mode)) {
+      p->err = S_ISDIR(mode) ? EISDIR : EINVAL;
+      return;
+    }
+    if ((p->expect & CLI_PATH_DIR) && !S_ISDIR(mode)) {
+      p->err = ENOTDIR;
+      return;
+    }
+  }
+
+  if ((p->expect & CLI_PATH_READABLE) && access(p->path, R_OK) != 0) {
+    p->err = errno;
+  }
+}
+
+cli_err cli_check_paths(cli_command* cli) {
+  // lazy path options are only copied out on conversion
+  for (size_t g = 0; g <= cli->opts->n_shared; g++) {
+    cli_opts* o = cli_opts_at(cli->opts, g);
+    for (size_t i = 0; i < o->idx; i++) {
+      if (o->opts[i]->parser == path_opt_parser) {
+        cli_err err = cli_opt_resolve(o->opts[i]);
+        if (err != CLI_OK) {
+          return err;
+        }
+      }
+    }
+  }
+
+  size_t n = 0;
+  for (size_t g = 0; g <= cli->n_groups; g++) {
+    cli_command* c = g == 0 ? cli : cli->groups[g - 1];
+    for (size_t i = 0; i < c->paths.n; i++) {
+      n += c->paths.items[i].expect != CLI_PATH_ANY;
+    }
+  }
+  if (n == 0) {
+    return CLI_OK;
+  }
+
+  cli_path** checks = (cli_path**)malloc(n * sizeof(cli_path*));
+  if (checks == NULL) {
+    return CLI_OUT_OF_MEMORY;
+  }
+  size_t k = 0;
+  for (size_t g = 0; g <= cli->n_groups; g++) {
+    cli_command* c = g == 0 ? cli : cli->groups[g - 1];
+    for (size_t i = 0; i < c->paths.n; i++) {
+      if (c->paths.items[i].expect != CLI_PATH_ANY) {
+        checks[k++] = &c->paths.items[i];
+      }
+    }
+  }
+
+  size_t n_threads = (n + CLI_PATHS_PER_THREAD - 1) / CLI_PATHS_PER_THREAD;
+  if (n_threads > CLI_PATH_THREADS) {
+    n_threads = CLI_PATH_THREADS;
+  }
+  cli_pool_run(cli_path_check, checks, n, n_threads);
+
+  // list the failures in batch order (the command's own paths, then each
+  // group's), reusing the batch for the list
+  size_t n_bad = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (checks[i]->err != 0) {
+      checks[n_bad++] = checks[i];
+    }
+  }
+  free(cli->paths.bad);
+  cli->paths.bad = checks;
+  cli->paths.n_bad = n_bad;
+  return n_bad == 0 ? CLI_OK : CLI_BAD_PATHS;
+}
+
+size_t cli_bad_path_count(cli_command* cli) {
+  return cli->paths.n_bad;
+}
+
+const char* cli_bad_path(cli_command* cli, size_t i, int* err) {
+  if (i >= cli->paths.n_bad) {
+    return NULL;
+  }
+  if (err != NULL) {
+    *err = cli->paths.bad[i]->err;
+  }
+  return cli->paths.bad[i]->path;
+}
+
+// deferred actions
+
+cli_err cli_add_action(cli_command* cli,
+                       const char* name,
+                       cli_action action,
+                       void* ctx) {
+  if (name == NULL) {
+    return CLI_NAME_REQUIRED;
+  }
+  cli_opt* opt = cli_opts_find(cli->opts, name);
+  if (opt == NULL) {
+    return CLI_NOT_FOUND;
+  }
+  opt->action = action;
+  opt->action_ctx = ctx;
+  return CLI_OK;
+}
+
+typedef struct cli_action_job {
+  cli_opt* opt;
+  cli_err err;
+} cli_action_job;
+
+void cli_action_job_run(void* ctx, size_t i) {
+  cli_action_job* job = (cli_action_job*)ctx + i;
+  job->err = job->opt->action(job->opt->action_ctx);
+}
+
+cli_err cli_run_actions(cli_command* cli, size_t n_threads) {
+  cli_opts* opts = cli->opts;
+
+  // collect the seen options with an action, converting lazy values up
+  // front so no action races a conversion
+  size_t n = 0;
+  for (size_t g = 0; g <= opts->n_shared; g++) {
+    cli_opts* o = cli_opts_at(opts, g);
+    for (size_t i = 0; i < o->idx; i++) {
+      if (o->opts[i]->seen && o->opts[i]->action != NULL) {
+        cli_err err = cli_opt_resolve(o->opts[i]);
+        if (err != CLI_OK) {
+          return err;
+        }
+        n++;
+      }
+    }
+  }
+  if (n == 0) {
+    return CLI_OK;
+  }
+
+  cli_action_job* jobs = (cli_action_job*)malloc(n * sizeof(cli_action_job));
+  if (jobs == NULL) {
+    return CLI_OUT_OF_MEMORY;
+  }
+
+  size_t k = 0;
+  for (size_t g = 0; g <= opts->n_shared; g++) {
+    cli_opts* o = cli_opts_at(opts, g);
+    for (size_t i = 0; i < o->idx; i++) {
+      if (o->opts[i]->seen && o->opts[i]->action != NULL) {
+        jobs[k].opt = o->opts[i];
+        jobs[k].err = CLI_OK;
+        k++;
+      }
+    }
+  }
+
+  cli_pool_run(cli_action_job_run, jobs, n, n_threads);
+
+  cli_err err = CLI_OK;
+  for (size_t i = 0; i < n && err == CLI_OK; i++) {
+    err = jobs[i].err;
+  }
+  free(jobs);
+  return err;
+}
+
+void cli_print_help_and_exit(cli_command* cli, int status) {
+  char initial[] =
+      "%s\n\nUsage:\n\t%s %s\nOptions:\n\t-h,--help\tPrint usage and exit.\n";
+
+  fprintf(stderr, initial, cli->desc, cli->argv[0], cli->usage);
+
+  // options are written straight out so there is no limit on how many fit
+  if (cli->opts != NULL) {
+    for (size_t g = 0; g <= cli->opts->n_shared; g++) {
+      cli_opts* o = cli_opts_at(cli->opts, g);
+      for (size_t i = 0; i < o->idx; i++) {
+        const char* name = o->opts[i]->name;
+        if ((strcmp(name, "help") == 0) || (strcmp(name, "h") == 0)) {
+          continue;
+        }
+        cli_opt_print_message(o->opts[i], stderr);
+      }
+    }
+  }
+
+  fprintf(stderr, "\n");
+  exit(status);
+}
+
+// snapshots
+// a parse result as a flat, pointer free blob:
+//   header | (seen bitset | values of seen options) per option set |
+//   values of positionals
+// the command's own options are the first set, then each attached group's.
+// fixed size values are stored as their bytes, strings as u32 length + bytes.
+// custom, path, file and range types keep their raw token and are parsed
+// again on read, so a file is mapped again by the reader. a variadic path
+// argument is a u32 count followed by its paths, a key=value table likewise
+// with its pairs.
+
+#define CLI_SNAPSHOT_MAGIC 0x534c4943u  // "CLIS"
+#define CLI_SNAPSHOT_VERSION 2u
+
+typedef struct cli_snapshot_header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t schema;  // hash of the registered names and kinds
+  uint32_t n_opts;
+  uint32_t n_args;
+  uint32_t size;  // whole blob in bytes
+} cli_snapshot_header;
+
+// value kinds by parser. parser addresses are not stable across processes so
+// the blob only ever stores these.
+typedef enum cli_kind {
+  CLI_KIND_NONE = 0,
+  CLI_KIND_FLAG,
+  CLI_KIND_INT,
+  CLI_KIND_FLOAT,
+  CLI_KIND_STR,
+  CLI_KIND_CHOICE,
+  CLI_KIND_SIZE,
+  CLI_KIND_DURATION,
+  CLI_KIND_CUSTOM,
+  CLI_KIND_PATH,
+  CLI_KIND_PATHS,
+  CLI_KIND_FILE,
+  CLI_KIND_BITSET,
+  CLI_KIND_RANGES,
+  CLI_KIND_KV
+} cli_kind;
+
+typedef struct cli_opt_kind_entry {
+  cli_opt_parser parser;
+  cli_kind kind;
+} cli_opt_kind_entry;
+
+typedef struct cli_arg_kind_entry {
+  cli_arg_parser parser;
+  cli_kind kind;
+} cli_arg_kind_entry;
+
+static const cli_opt_kind_entry cli_opt_kinds[] = {
+    {bool_opt_parser, CLI_KIND_FLAG},
+    {int_opt_parser, CLI_KIND_INT},
+    {float_opt_parser, CLI_KIND_FLOAT},
+    {str_opt_parser, CLI_KIND_STR},
+    {choice_opt_parser, CLI_KIND_CHOICE},
+    {size_opt_parser, CLI_KIND_SIZE},
+    {duration_opt_parser, CLI_KIND_DURATION},
+    {custom_opt_parser, CLI_KIND_CUSTOM},
+    {path_opt_parser, CLI_KIND_PATH},
+    {file_opt_parser, CLI_KIND_FILE},
+    {bitset_opt_parser, CLI_KIND_BITSET},
+    {ranges_opt_parser, CLI_KIND_RANGES},
+    {kv_opt_parser, CLI_KIND_KV},
+};
+
+static const cli_arg_kind_entry cli_arg_kinds[] = {
+    {int_arg_parser, CLI_KIND_INT},
+    {float_arg_parser, CLI_KIND_FLOAT},
+    {str_arg_parser, CLI_KIND_STR},
+    {custom_arg_parser, CLI_KIND_CUSTOM},
+    {path_arg_parser, CLI_KIND_PATH},
+    {paths_arg_parser, CLI_KIND_PATHS},
+};
+
+cli_kind cli_opt_kind(cli_opt* opt) {
+  for (size_t i = 0; i < sizeof(cli_opt_kinds) / sizeof(cli_opt_kinds[0]);
+       i++) {
+    if (cli_opt_kinds[i].parser == opt->parser) {
+      return cli_opt_kinds[i].kind;
+    }
+  }
+  return CLI_KIND_NONE;
+}
+
+cli_kind cli_arg_kind(cli_arg* arg) {
+  for (size_t i = 0; i < sizeof(cli_arg_kinds) / sizeof(cli_arg_kinds[0]);
+       i++) {
+    if (cli_arg_kinds[i].parser == arg->parser) {
+      return cli_arg_kinds[i].kind;
+    }
+  }
+  return CLI_KIND_NONE;
+}
+
+uint32_t cli_snapshot_schema(cli_command* cli) {
+  uint32_t h = 2166136261u;
+  for (size_t g = 0; g <= cli->opts->n_shared; g++) {
+    cli_opts* o = cli_opts_at(cli->opts, g);
+    for (size_t i = 0; i < o->idx; i++) {
+      cli_opt* opt = o->opts[i];
+      h = (h ^ choice_hash(opt->name, strlen(opt->name), 0)) * 16777619u;
+      h = (h ^ (uint32_t)cli_opt_kind(opt)) * 16777619u;
+    }
+    // a set boundary, so moving an option into a group changes the hash
+    h = (h ^ 0xffu) * 16777619u;
+  }
+  for (size_t i = 0; i < cli->args->idx; i++) {
+    h = (h ^ (uint32_t)cli_arg_kind(cli->args->args[i])) * 16777619u;
+  }
+  return h;
+}
+
+// a write cursor that keeps counting past `cap` so one pass also sizes
+typedef struct cli_writer {
+  unsigned char* buf;
+  size_t cap;
+  size_t len;
+} cli_writer;
+
+void cli_writer_put(cli_writer* w, const void* src, size_t n) {
+  if (w->len + n <= w->cap) {
+    memcpy(w->buf + w->len, src, n);
+  }
+  w->len += n;
+}
+
+void cli_writer_put_bytes(cli_writer* w, const char* src, size_t n) {
+  uint32_t n32 = (uint32_t)n;
+  cli_writer_put(w, &n32, sizeof(n32));
+  cli_writer_put(w, src, n);
+}
+
+void cli_writer_put_value(cli_writer* w,
+                          cli_kind kind,
+                          void* value,
+                          const char* raw,
+                          size_t raw_len) {
+  switch (kind) {
+    case CLI_KIND_FLAG:
+      cli_writer_put(w, value, sizeof(bool));
+      break;
+    case CLI_KIND_INT:
+      cli_writer_put(w, value, sizeof(int));
+      break;
+    case CLI_KIND_FLOAT:
+      cli_writer_put(w, value, sizeof(float));
+      break;
+    case CLI_KIND_STR: {
+      str_box* box = (str_box*)value;
+      cli_writer_put_bytes(w, box->ptr, strlen(box->ptr));
+      break;
+    }
+    case CLI_KIND_CHOICE:
+      cli_writer_put(w, ((choice_box*)value)->out, sizeof(int));
+      break;
+    case CLI_KIND_SIZE:
+      cli_writer_put(w, value, sizeof(uint64_t));
+      break;
+    case CLI_KIND_DURATION:
+      cli_writer_put(w, value, sizeof(int64_t));
+      break;
+    case CLI_KIND_CUSTOM:
+    case CLI_KIND_PATH:
+    case CLI_KIND_FILE:
+    case CLI_KIND_BITSET:
+    case CLI_KIND_RANGES:
+      cli_writer_put_bytes(w, raw, raw_len);
+      break;
+    case CLI_KIND_KV: {
+      cli_kv* kv = (cli_kv*)value;
+      uint32_t n32 = (uint32_t)kv->n;
+      cli_writer_put(w, &n32, sizeof(n32));
+      for (size_t i = 0; i < kv->n; i++) {
+        const cli_kv_entry* e = &kv->entries[i];
+        n32 = (uint32_t)(e->key_len + 1 + e->value_len);
+        cli_writer_put(w, &n32, sizeof(n32));
+        cli_writer_put(w, e->key, e->key_len);
+        cli_writer_put(w, "=", 1);
+        cli_writer_put(w, e->value, e->value_len);
+      }
+      break;
+    }
+    case CLI_KIND_PATHS: {
+      cli_paths* store = ((path_box*)value)->store;
+      uint32_t n32 = (uint32_t)store->n_rest;
+      cli_writer_put(w, &n32, sizeof(n32));
+      for (size_t i = 0; i < store->n_rest; i++) {
+        cli_writer_put_bytes(w, store->rest[i], strlen(store->rest[i]));
+      }
+      break;
+    }
+    case CLI_KIND_NONE:
+      break;
+  }
+}
+
+cli_err cli_snapshot_write(cli_command* cli,
+                           void* buf,
+                           size_t cap,
+                           size_t* len) {
+  cli_writer w = {(unsigned char*)buf, cap, 0};
+  cli_args* args = cli->args;
+
+  cli_snapshot_header h;
+  h.magic = CLI_SNAPSHOT_MAGIC;
+  h.version = CLI_SNAPSHOT_VERSION;
+  h.schema = cli_snapshot_schema(cli);
+  h.n_opts = (uint32_t)cli_opts_total(cli->opts);
+  h.n_args = (uint32_t)args->idx;
+  h.size = 0;
+  cli_writer_put(&w, &h, sizeof(h));
+
+  for (size_t g = 0; g <= cli->opts->n_shared; g++) {
+    cli_opts* opts = cli_opts_at(cli->opts, g);
+    unsigned char seen[(CLI_MAX_OPTS + 7) / 8] = {0};
+    for (size_t i = 0; i < opts->idx; i++) {
+      if (opts->opts[i]->seen) {
+        seen[i / 8] |= (unsigned char)(1u << (i % 8));
+      }
+    }
+    cli_writer_put(&w, seen, (opts->idx + 7) / 8);
+
+    for (size_t i = 0; i < opts->idx; i++) {
+      cli_opt* opt = opts->opts[i];
+      if (!opt->seen) {
+        continue;
+      }
+      // lazy values are settled first so only typed values go out
+      cli_err err = cli_opt_resolve(opt);
+      if (err != CLI_OK) {
+        return err;
+      }
+      cli_writer_put_value(&w, cli_opt_kind(opt), opt->value, opt->raw,
+                           opt->raw_len);
+    }
+  }
+
+  for (size_t i = 0; i < args->idx; i++) {
+    cli_arg* arg = args->args[i];
+    cli_writer_put_value(&w, cli_arg_kind(arg), arg->value, arg->raw,
+                         arg->raw_len);
+  }
+
+  *len = w.len;
+  if (w.len > cap) {
+    return CLI_OUT_OF_BOUNDS;
+  }
+
+  // the size goes in last, once it is known
+  h.size = (uint32_t)w.len;
+  memcpy(buf, &h, sizeof(h));
+  return CLI_OK;
+}
+
+// a read cursor. every take is bounds checked against the blob.
+typedef struct cli_reader {
+  const unsigned char* buf;
+  size_t len;
+  size_t pos;
+} cli_reader;
+
+bool cli_reader_take(cli_reader* r, void* dst, size_t n) {
+  if (r->len - r->pos < n) {
+    return false;
+  }
+  memcpy(dst, r->buf + r->pos, n);
+  r->pos += n;
+  return true;
+}
+
+bool cli_reader_take_bytes(cli_reader* r, const char** src, size_t* n) {
+  uint32_t n32;
+  if (!cli_reader_take(r, &n32, sizeof(n32)) || r->len - r->pos < n32) {
+    return false;
+  }
+  *src = (const char*)(r->buf + r->pos);
+  *n = n32;
+  r->pos += n32;
+  return true;
+}
+
+// write one stored value back into the registered target. strings and custom
+// values go through their parser so buffer sizes and user decoding apply.
+cli_err cli_reader_take_value(cli_reader* r,
+                              cli_kind kind,
+                              void* value,
+                              void* parse_target,
+                              cli_err (*parse)(void*, const char*, size_t)) {
+  const char* src;
+  size_t n;
+  bool ok = true;
+
+  switch (kind) {
+    case CLI_KIND_FLAG:
+      ok = cli_reader_take(r, value, sizeof(bool));
+      break;
+    case CLI_KIND_INT:
+      ok = cli_reader_take(r, value, sizeof(int));
+      break;
+    case CLI_KIND_FLOAT:
+      ok = cli_reader_take(r, value, sizeof(float));
+      break;
+    case CLI_KIND_CHOICE:
+      ok = cli_reader_take(r, ((choice_box*)value)->out, sizeof(int));
+      break;
+    case CLI_KIND_SIZE:
+      ok = cli_reader_take(r, value, sizeof(uint64_t));
+      break;
+    case CLI_KIND_DURATION:
+      ok = cli_reader_take(r, value, sizeof(int64_t));
+      break;
+    case CLI_KIND_STR:
+    case CLI_KIND_CUSTOM:
+    case CLI_KIND_PATH:
+    case CLI_KIND_FILE:
+    case CLI_KIND_BITSET:
+    case CLI_KIND_RANGES:
+      if (!cli_reader_take_bytes(r, &src, &n)) {
+        return CLI_BAD_SNAPSHOT;
+      }
+      return parse(parse_target, src, n);
+    case CLI_KIND_PATHS:
+    case CLI_KIND_KV: {
+      uint32_t n32;
+      if (!cli_reader_take(r, &n32, sizeof(n32))) {
+        return CLI_BAD_SNAPSHOT;
+      }
+      for (uint32_t i = 0; i < n32; i++) {
+        if (!cli_reader_take_bytes(r, &src, &n)) {
+          return CLI_BAD_SNAPSHOT;
+        }
+        cli_err err = parse(parse_target, src, n);
+        if (err != CLI_OK) {
+          return err;
+        }
+      }
+      break;
+    }
+    case CLI_KIND_NONE:
+      break;
+  }
+  return ok ? CLI_OK : CLI_BAD_SNAPSHOT;
+}
+
+cli_err cli_snapshot_opt_parse(void* target, const char* token, size_t len) {
+  cli_opt* opt = (cli_opt*)target;
+  return opt->parser(opt, token, len);
+}
+
+cli_err cli_snapshot_arg_parse(void* target, const char* token, size_t len) {
+  cli_arg* arg = (cli_arg*)target;
+  return arg->parser(arg, token, len);
+}
+
+cli_err cli_snapshot_read(cli_command* cli, const void* buf, size_t len) {
+  cli_reader r = {(const unsigned char*)buf, len, 0};
+  cli_args* args = cli->args;
+
+  cli_snapshot_header h;
+  if (!cli_reader_take(&r, &h, sizeof(h)) || h.magic != CLI_SNAPSHOT_MAGIC ||
+      h.version != CLI_SNAPSHOT_VERSION || h.size != len ||
+      h.n_opts != cli_opts_total(cli->opts) || h.n_args != args->idx ||
+      h.schema != cli_snapshot_schema(cli)) {
+    return CLI_BAD_SNAPSHOT;
+  }
+
+  // cli_begin clears the seen flags of every set, groups included
+  cli_begin(cli);
+  for (size_t g = 0; g <= cli->opts->n_shared; g++) {
+    cli_opts* opts = cli_opts_at(cli->opts, g);
+    unsigned char seen[(CLI_MAX_OPTS + 7) / 8];
+    if (!cli_reader_take(&r, seen, (opts->idx + 7) / 8)) {
+      return CLI_BAD_SNAPSHOT;
+    }
+
+    for (size_t i = 0; i < opts->idx; i++) {
+      cli_opt* opt = opts->opts[i];
+      if ((seen[i / 8] & (1u << (i % 8))) == 0) {
+        continue;
+      }
+      opt->seen = true;
+      cli_err err = cli_reader_take_value(&r, cli_opt_kind(opt), opt->value,
+                                          opt, cli_snapshot_opt_parse);
+      if (err != CLI_OK) {
+        return err;
+      }
+    }
+  }
+
+  for (size_t i = 0; i < args->idx; i++) {
+    cli_arg* arg = args->args[i];
+    cli_err err = cli_reader_take_value(&r, cli_arg_kind(arg), arg->value, arg,
+                                        cli_snapshot_arg_parse);
+    if (err != CLI_OK) {
+      return err;
+    }
+  }
+  return CLI_OK;
+}
+
+// live values
+// one immutable table per reload, published through an atomic pointer.
+// readers announce themselves on one of two counters picked by the epoch
+// parity. after swapping the pointer a reload flips the epoch and waits for
+// the old parity to drain; anyone who could still hold the old table counted
+// there, so it can then be freed.
+
+struct cli_values {
+  size_t n;
+  cli_opt** opts;   // the option at each slot
+  size_t* offsets;  // into data, SIZE_MAX for types that aren't carried
+  bool* seen;
+  unsigned char* data;
+};
+
+typedef struct cli_live_counter {
+  _Alignas(64) atomic_uint readers;
+} cli_live_counter;
+
+struct cli_live {
+  cli_command* cli;
+  cli_values* defaults;  // the targets before any parse
+  _Atomic(cli_values*) current;
+  atomic_uint epoch;
+  cli_live_counter counters[2];
+  pthread_mutex_t reload;
+};
+
+// bytes of an option's value in a table, 0 if it isn't carried
+size_t cli_live_value_size(cli_opt* opt) {
+  switch (cli_opt_kind(opt)) {
+    case CLI_KIND_FLAG:
+      return sizeof(bool);
+    case CLI_KIND_INT:
+    case CLI_KIND_CHOICE:
+      return sizeof(int);
+    case CLI_KIND_FLOAT:
+      return sizeof(float);
+    case CLI_KIND_SIZE:
+      return sizeof(uint64_t);
+    case CLI_KIND_DURATION:
+      return sizeof(int64_t);
+    case CLI_KIND_STR:
+      return ((str_box*)opt->value)->sz;
+    default:
+      return 0;
+  }
+}
+
+// where the parse put an option's value
+void* cli_live_target(cli_opt* opt) {
+  switch (cli_opt_kind(opt)) {
+    case CLI_KIND_STR:
+      return ((str_box*)opt->value)->ptr;
+    case CLI_KIND_CHOICE:
+      return ((choice_box*)opt->value)->out;
+    default:
+      return opt->value;
+  }
+}
+
+// slots run through the own options and then each group's, every set in
+// the order of its sorted index so a name finds its slot by binary search.
+cli_opt* cli_values_opt(cli_opts* opts, size_t g, size_t i) {
+  cli_opts* o = cli_opts_at(opts, g);
+  cli_opts_build_index(o);
+  return o->sorted[i];
+}
+
+// copy the option targets of the first `n_sets` option sets (the own one,
+// then the groups) into a fresh table, all in one allocation. NULL when out
+// of memory.
+cli_values* cli_values_capture(cli_opts* opts, size_t n_sets) {
+  size_t n = 0;
+  for (size_t g = 0; g < n_sets; g++) {
+    n += cli_opts_at(opts, g)->idx;
+  }
+  size_t size = 0;
+  for (size_t g = 0; g < n_sets; g++) {
+    for (size_t i = 0; i < cli_opts_at(opts, g)->idx; i++) {
+      cli_opt* opt = cli_values_opt(opts, g, i);
+      size += (cli_live_value_size(opt) + 7) & ~(size_t)7;
+    }
+  }
+
+  size_t head = sizeof(cli_values) + n * (sizeof(cli_opt*) + sizeof(size_t));
+  head = (head + n * sizeof(bool) + 7) & ~(size_t)7;
+  unsigned char* block = (unsigned char*)malloc(head + size);
+  if (block == NULL) {
+    return NULL;
+  }
+
+  cli_values* v = (cli_values*)block;
+  v->n = n;
+  v->opts = (cli_opt**)(block + sizeof(cli_values));
+  v->offsets = (size_t*)(v->opts + n);
+  v->seen = (bool*)(v->offsets + n);
+  v->data = block + head;
+
+  size_t off = 0;
+  size_t k = 0;
+  for (size_t g = 0; g < n_sets; g++) {
+    for (size_t i = 0; i < cli_opts_at(opts, g)->idx; i++, k++) {
+      cli_opt* opt = cli_values_opt(opts, g, i);
+      size_t sz = cli_live_value_size(opt);
+      v->opts[k] = opt;
+      v->seen[k] = opt->seen;
+      v->offsets[k] = sz == 0 ? SIZE_MAX : off;
+      if (sz > 0) {
+        memcpy(v->data + off, cli_live_target(opt), sz);
+        off += (sz + 7) & ~(size_t)7;
+      }
+    }
+  }
+  return v;
+}
+
+// put the captured values back into the targets
+void cli_values_restore(const cli_values* v) {
+  for (size_t k = 0; k < v->n; k++) {
+    if (v->offsets[k] != SIZE_MAX) {
+      cli_opt* opt = v->opts[k];
+      memcpy(cli_live_target(opt), v->data + v->offsets[k],
+             cli_live_value_size(opt));
+    }
+  }
+}
+
+// the own option targets as they were before the first parse. taken on the
+// first use and again whenever options were registered since, after putting
+// the known ones back so only the new ones are taken as they are. out of
+// memory, the targets are left as they are.
+void cli_defaults_restore(cli_command* cli) {
+  cli_values* d = cli->defaults;
+  if (d != NULL && d->n == cli->opts->idx) {
+    cli_values_restore(d);
+    return;
+  }
+  if (d != NULL) {
+    cli_values_restore(d);
+    free(d);
+  }
+  cli->defaults = cli_values_capture(cli->opts, 1);
+}
+
+cli_live* cli_live_new(cli_command* cli) {
+  cli_live* live = (cli_live*)malloc(sizeof(cli_live));
+  size_t n_sets = cli->opts->n_shared + 1;
+  cli_values* defaults = cli_values_capture(cli->opts, n_sets);
+  cli_values* current = cli_values_capture(cli->opts, n_sets);
+  if (live == NULL || defaults == NULL || current == NULL) {
+    free(live);
+    free(defaults);
+    free(current);
+    return NULL;
+  }
+  live->cli = cli;
+  live->defaults = defaults;
+  atomic_init(&live->current, current);
+  atomic_init(&live->epoch, 0);
+  atomic_init(&live->counters[0].readers, 0);
+  atomic_init(&live->counters[1].readers, 0);
+  if (pthread_mutex_init(&live->reload, NULL) != 0) {
+    free(live);
+    free(defaults);
+    free(current);
+    return NULL;
+  }
+  return live;
+}
+
+void cli_live_destroy(cli_live* live) {
+  pthread_mutex_destroy(&live->reload);
+  free(atomic_load(&live->current));
+  free(live->defaults);
+  free(live);
+}
+
+unsigned cli_live_acquire(cli_live* live, const cli_values** values) {
+  for (;;) {
+    unsigned e = atomic_load(&live->epoch) & 1;
+    atomic_fetch_add(&live->counters[e].readers, 1);
+    // a flip in between could have missed us, retry on the new parity
+    if ((atomic_load(&live->epoch) & 1) == e) {
+      *values = atomic_load(&live->current);
+      return e;
+    }
+    atomic_fetch_sub(&live->counters[e].readers, 1);
+  }
+}
+
+void cli_live_release(cli_live* live, unsigned token) {
+  atomic_fetch_sub(&live->counters[token & 1].readers, 1);
+}
+
+// publish the targets of a successful parse and reclaim the old table
+cli_err cli_live_publish(cli_live* live, cli_err err) {
+  if (err != CLI_OK) {
+    return err;
+  }
+
+  cli_opts* opts = live->cli->opts;
+  for (size_t g = 0; g <= opts->n_shared; g++) {
+    cli_opts* o = cli_opts_at(opts, g);
+    for (size_t i = 0; i < o->idx; i++) {
+      err = cli_opt_resolve(o->opts[i]);
+      if (err != CLI_OK) {
+        return err;
+      }
+    }
+  }
+
+  cli_values* fresh = cli_values_capture(opts, opts->n_shared + 1);
+  if (fresh == NULL) {
+    return CLI_OUT_OF_MEMORY;
+  }
+  cli_values* old = atomic_exchange(&live->current, fresh);
+  unsigned e = atomic_fetch_add(&live->epoch, 1) & 1;
+  while (atomic_load(&live->counters[e].readers) != 0) {
+    sched_yield();
+  }
+  free(old);
+  return CLI_OK;
+}
+
+cli_err cli_live_reload(cli_live* live, int argc, char** argv) {
+  pthread_mutex_lock(&live->reload);
+  cli_command* cli = live->cli;
+  cli_values_restore(live->defaults);
+
+  cli_begin(cli);
+  cli_err err = CLI_OK;
+  for (int i = 1; i < argc && err == CLI_OK; i++) {
+    err = cli_feed(cli, argv[i], strlen(argv[i]));
+  }
+  if (err == CLI_OK) {
+    err = cli_finish(cli);
+  }
+
+  err = cli_live_publish(live, err);
+  pthread_mutex_unlock(&live->reload);
+  return err;
+}
+
+cli_err cli_live_reload_line(cli_live* live, char* line, size_t len) {
+  pthread_mutex_lock(&live->reload);
+  cli_values_restore(live->defaults);
+  cli_err err = cli_live_publish(live, cli_parse_line(live->cli, line, len));
+  pthread_mutex_unlock(&live->reload);
+  return err;
+}
+
+size_t cli_live_slot(cli_live* live, const char* name) {
+  cli_opts* opts = live->cli->opts;
+  size_t base = 0;
+  for (size_t g = 0; g <= opts->n_shared; g++) {
+    cli_opts* o = cli_opts_at(opts, g);
+    size_t i = cli_opts_lower_bound(o, name, strlen(name) + 1);
+    if (i < o->idx && strcmp(o->sorted[i]->name, name) == 0) {
+      return base + i;
+    }
+    base += o->idx;
+  }
+  return SIZE_MAX;
+}
+
+const void* cli_values_get(const cli_values* values, size_t slot) {
+  if (slot >= values->n || values->offsets[slot] == SIZE_MAX) {
+    return NULL;
+  }
+  return values->data + values->offsets[slot];
+}
+
+bool cli_values_seen(const cli_values* values, size_t slot) {
+  return slot < values->n && values->seen[slot];
+}
+
+// error context
+
+void cli_set_embedded(cli_command* cli, bool embedded) {
+  cli->embedded = embedded;
+}
+
+const cli_opt* cli_opts_unseen_required(cli_opts* opts) {
+  for (size_t g = 0; g <= opts->n_shared; g++) {
+    cli_opts* o = cli_opts_at(opts, g);
+    for (size_t i = 0; i < o->idx; i++) {
+      if (o->opts[i]->required && !o->opts[i]->seen) {
+        return o->opts[i];
+      }
+    }
+  }
+  return NULL;
+}
+
+cli_error cli_last_error(cli_command* cli) {
+  cli_error e = {cli->err, -1, NULL, 0, NULL};
+  if (cli->err == CLI_OK) {
+    return e;
+  }
+
+  const cli_parser* p = &cli->parser;
+  if (p->err_idx >= 0) {
+    e.index = p->err_idx;
+    e.token = p->err_token;
+    e.token_len = p->err_len;
+  }
+
+  const cli_opt* opt = p->err_opt;
+  if (opt == NULL && cli->err == CLI_UNSEEN_REQ_OPTS) {
+    opt = cli_opts_unseen_required(cli->opts);
+  }
+  e.option = opt != NULL ? opt->name : NULL;
+  return e;
+}
+
+// snprintf at buf + len, still counting once the buffer is full
+size_t cli_appendf(char* buf, size_t cap, size_t len, const char* fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  int n = len < cap ? vsnprintf(buf + len, cap - len, fmt, ap)
+                    : vsnprintf(NULL, 0, fmt, ap);
+  va_end(ap);
+  return len + (n > 0 ? (size_t)n : 0);
+}
+
+// "--name: <message> (argv[i] "token")", leaving out what is unknown
+size_t cli_format_error(const cli_error* e, char* buf, size_t cap) {
+  size_t len = 0;
+  if (e->option != NULL) {
+    const char* dashes = strlen(e->option) == 1 ? "-" : "--";
+    len = cli_appendf(buf, cap, len, "%s%s: ", dashes, e->option);
+  }
+  len = cli_appendf(buf, cap, len, "%s", cli_err_str(e->code));
+  if (e->token != NULL) {
+    len = cli_appendf(buf, cap, len, " (argv[%d] \"%.*s\")", e->index,
+                      (int)e->token_len, e->token);
+  }
+  return len;
+}
+
+// suggestions
+
+// bounded levenshtein distance between a pattern of at most 64 bytes and
+// `text`, using the bit-parallel algorithm of Myers (1999) in Hyyro's
+// formulation. `peq` holds the pattern match masks per byte. gives up and
+// returns max + 1 once the distance can no longer come in under `max`.
+size_t cli_edit_distance(const uint64_t* peq,
+                         size_t m,
+                         const char* text,
+                         size_t n,
+                         size_t max) {
+  if ((m > n ? m - n : n - m) > max) {
+    return max + 1;
+  }
+
+  uint64_t last = (uint64_t)1 << (m - 1);
+  uint64_t pv = ~(uint64_t)0;
+  uint64_t mv = 0;
+  size_t score = m;
+
+  for (size_t j = 0; j < n; j++) {
+    uint64_t eq = peq[(unsigned char)text[j]];
+    uint64_t xv = eq | mv;
+    uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+    uint64_t ph = mv | ~(xh | pv);
+    uint64_t mh = pv & xh;
+
+    if (ph & last) {
+      score++;
+    } else if (mh & last) {
+      score--;
+    }
+
+    // each remaining text byte can lower the score by at most one
+    if (score > max + (n - j - 1)) {
+      return max + 1;
+    }
+
+    ph = (ph << 1) | 1;
+    mh <<= 1;
+    pv = mh | ~(xv | ph);
+    mv = ph & xv;
+  }
+  return score;
+}
+
+const char* cli_unknown_token(cli_command* cli, size_t* len) {
+  if (cli->err != CLI_NOT_FOUND && cli->err != CLI_AMBIGUOUS_OPT) {
+    return NULL;
+  }
+
+  const char* token = cli->parser.err_token;
+  size_t token_len = cli->parser.err_len;
+  if (token_len >= 2 && strncmp(token, "--", 2) == 0) {
+    token += 2;
+    token_len -= 2;
+  } else if (token_len >= 1 && token[0] == '-') {
+    token += 1;
+    token_len -= 1;
+  }
+
+  const char* eq = (const char*)memchr(token, '=', token_len);
+  *len = eq == NULL ? token_len : (size_t)(eq - token);
+  return token;
+}
+
+size_t cli_suggest(cli_command* cli, const char** out, size_t n) {
+  size_t m = 0;
+  const char* token = cli_unknown_token(cli, &m);
+  // registered names are shorter than CLI_OPT_TOKEN_MAX_LEN so anything
+  // longer than a machine word is never within reach.
+  if (token == NULL || m == 0 || m > 64 || n == 0 || cli->opts == NULL) {
+    return 0;
+  }
+
+  uint64_t peq[256] = {0};
+  for (size_t i = 0; i < m; i++) {
+    peq[(unsigned char)token[i]] |= (uint64_t)1 << i;
+  }
+
+  // short tokens get a tighter bound or everything would be "close"
+  size_t max = m / 2 > 0 ? m / 2 : 1;
+  if (max > CLI_SUGGEST_MAX_DIST) {
+    max = CLI_SUGGEST_MAX_DIST;
+  }
+
+  if (n > CLI_MAX_OPTS) {
+    n = CLI_MAX_OPTS;
+  }
+
+  // insertion into `out` keeps it ordered by distance, then by name
+  size_t dists[CLI_MAX_OPTS];
+  size_t found = 0;
+
+  for (size_t g = 0; g <= cli->opts->n_shared; g++) {
+    cli_opts* o = cli_opts_at(cli->opts, g);
+    cli_opts_build_index(o);
+    for (size_t i = 0; i < o->idx; i++) {
+      const char* name = o->sorted[i]->name;
+      size_t d = cli_edit_distance(peq, m, name, strlen(name), max);
+      if (d > max || (found == n && d >= dists[n - 1])) {
+        continue;
+      }
+
+      size_t k = found < n ? found++ : n - 1;
+      for (; k > 0 && dists[k - 1] > d; k--) {
+        dists[k] = dists[k - 1];
+        out[k] = out[k - 1];
+      }
+      dists[k] = d;
+      out[k] = name;
+    }
+  }
+  return found;
+}
+
+// incremental parsing
+
+void cli_begin(cli_command* cli) {
+  cli_parser_begin(&cli->parser, cli->opts);
+  cli->err = CLI_OK;
+  cli->stream.n = 0;
+  cli_globs_reset(&cli->globs);
+
+  for (size_t g = 0; g <= cli->n_groups; g++) {
+    cli_command* c = g == 0 ? cli : cli->groups[g - 1];
+    cli_defaults_restore(c);
+    cli_paths_reset(&c->paths);
+    cli_maps_reset(&c->maps);
+    for (size_t i = 0; i < c->kvs.n; i++) {
+      cli_kv_clear(c->kvs.items[i]);
+    }
+  }
 }
 
-cli_err cli_init(cli_command* cli,
-                 const char* desc,
-                 const char* usage,
-                 int argc,
-                 char** argv) {
-  cli->desc = desc;
-  cli->usage = usage;
-  cli->argc = argc;
-  cli->argv = argv;
+// whether a token is a pattern for the string or path argument it would fill
+bool cli_glob_target(cli_command* cli, const char* token, const cli_tok* t) {
+  cli_parser* p = &cli->parser;
+  if (!cli->globs.on || p->arg_i >= cli->args->idx) {
+    return false;
+  }
+  if (p->mode != CLI_MODE_ARGS &&
+      (p->mode != CLI_MODE_OPTS || t->kind != CLI_TOK_POSITIONAL)) {
+    return false;
+  }
 
-  // if we have opts allocate the requested amount
-  // we should always allocate 2 for optional help message flag `-h, --help`
-  cli_opts* opts = (cli_opts*)malloc(sizeof(cli_opts));
-  CLI_CHECK_MEM_ALLOC(opts);
-  cli_opts_init(opts, CLI_MAX_OPTS);
-  cli->opts = opts;
+  cli_arg_parser parser = cli->args->args[p->arg_i]->parser;
+  if (parser != str_arg_parser && parser != path_arg_parser &&
+      parser != paths_arg_parser) {
+    return false;
+  }
 
-  // help is really just used as token to break out of the parse.
-  // since we always add them we can simply print info to stderr later if -h or
-  // --help is raised.
-  cli_opts_add(opts, "h", "", noop_parser, NULL, false, true);
-  cli_opts_add(opts, "help", "", noop_parser, NULL, false, true);
+  for (size_t i = 0; i < t->len; i++) {
+    if (token[i] == '*' || token[i] == '?' || token[i] == '[') {
+      return true;
+    }
+  }
+  return false;
+}
 
-  cli_args* args = (cli_args*)malloc(sizeof(cli_args));
-  CLI_CHECK_MEM_ALLOC(args);
-  cli_args_init(args, CLI_MAX_ARGS);
-  cli->args = args;
+// expand a pattern and feed every match as a positional. the whole
+// expansion counts as the one token it came from.
+// the directory walk behind glob expansion. a pattern is matched one path
+// component at a time: literal components are appended as is, wildcard ones
+// read every directory of the previous level (in parallel when there are
+// several) and keep the names that fnmatch(3) accepts. every level is held
+// to the parse's remaining match budget and a read stops as soon as the
+// budget is gone, so no pattern costs more than CLI_MAX_GLOB_MATCHES paths.
 
-  // if every opt + arg is a string we would at most have MAX args and opts.
-  str_boxes* sb = (str_boxes*)malloc(sizeof(str_boxes));
-  str_boxes_init(sb, CLI_MAX_ARGS + CLI_MAX_OPTS);
-  cli->sb = sb;
+bool cli_glob_magic(const char* s) {
+  return strpbrk(s, "*?[") != NULL;
+}
+
+// `prefix` and `name` joined by one `/`, NULL when out of memory
+char* cli_glob_join(const char* prefix, const char* name, bool slash) {
+  size_t pn = strlen(prefix);
+  size_t nn = strlen(name);
+  bool sep = pn > 0 && prefix[pn - 1] != '/';
+  char* path = (char*)malloc(pn + sep + nn + slash + 1);
+  if (path == NULL) {
+    return NULL;
+  }
+  memcpy(path, prefix, pn);
+  if (sep) {
+    path[pn] = '/';
+  }
+  memcpy(path + pn + sep, name, nn);
+  if (slash) {
+    path[pn + sep + nn] = '/';
+  }
+  path[pn + sep + nn + slash] = '\0';
+  return path;
+}
+
+typedef struct cli_glob_level {
+  const cli_glob_list* dirs;  // the previous level's paths
+  const char* comp;           // the pattern component for this level
+  bool want_dir;              // keep directories only
+  bool slash;                 // and give them a trailing `/`
+  cli_glob_list* found;       // one list per directory
+  size_t budget;
+  atomic_size_t kept;
+  atomic_bool stop;  // over budget or out of memory
+  atomic_bool oom;
+} cli_glob_level;
+
+bool cli_glob_is_dir(DIR* d, const struct dirent* e) {
+#if defined(_DIRENT_HAVE_D_TYPE)
+  if (e->d_type == DT_DIR) {
+    return true;
+  }
+  if (e->d_type != DT_LNK && e->d_type != DT_UNKNOWN) {
+    return false;
+  }
+#endif
+  struct stat st;
+  return fstatat(dirfd(d), e->d_name, &st, 0) == 0 && S_ISDIR(st.st_mode);
+}
+
+void cli_glob_dir_job(void* ctx, size_t i) {
+  cli_glob_level* lv = (cli_glob_level*)ctx;
+  const char* prefix = lv->dirs->items[i];
+  int fd = open(prefix[0] != '\0' ? prefix : ".",
+                O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0) {
+    return;
+  }
+  DIR* d = fdopendir(fd);
+  if (d == NULL) {
+    close(fd);
+    return;
+  }
+
+  struct dirent* e;
+  while (!atomic_load(&lv->stop) && (e = readdir(d)) != NULL) {
+    const char* name = e->d_name;
+    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0 ||
+        fnmatch(lv->comp, name, FNM_PERIOD) != 0 ||
+        (lv->want_dir && !cli_glob_is_dir(d, e))) {
+      continue;
+    }
+    if (atomic_fetch_add(&lv->kept, 1) >= lv->budget) {
+      atomic_store(&lv->stop, true);
+      break;
+    }
+    char* path = cli_glob_join(prefix, name, lv->slash);
+    if (path == NULL || !cli_glob_list_push(&lv->found[i], path)) {
+      free(path);
+      atomic_store(&lv->oom, true);
+      atomic_store(&lv->stop, true);
+      break;
+    }
+  }
+  closedir(d);
+}
+
+// the next level for a wildcard component
+cli_err cli_glob_read_level(cli_glob_level* lv, cli_glob_list* next) {
+  size_t n = lv->dirs->n;
+  lv->found = (cli_glob_list*)calloc(n, sizeof(cli_glob_list));
+  if (lv->found == NULL) {
+    return CLI_OUT_OF_MEMORY;
+  }
+  atomic_init(&lv->kept, 0);
+  atomic_init(&lv->stop, false);
+  atomic_init(&lv->oom, false);
+
+  cli_pool_run(cli_glob_dir_job, lv, n,
+               n < CLI_GLOB_THREADS ? n : CLI_GLOB_THREADS);
 
+  cli_err err = CLI_OK;
+  if (atomic_load(&lv->oom)) {
+    err = CLI_OUT_OF_MEMORY;
+  } else if (atomic_load(&lv->kept) > lv->budget) {
+    err = CLI_GLOB_LIMIT;
+  }
+  for (size_t i = 0; i < n; i++) {
+    for (size_t j = 0; j < lv->found[i].n && err == CLI_OK; j++) {
+      if (!cli_glob_list_push(next, lv->found[i].items[j])) {
+        err = CLI_OUT_OF_MEMORY;
+        break;
+      }
+      lv->found[i].items[j] = NULL;
+    }
+    cli_glob_list_free(&lv->found[i]);
+  }
+  free(lv->found);
+  return err;
+}
+
+// the next level for a literal component, with backslash escapes removed.
+// only the last component is checked for existence, a missing directory
+// further up simply reads as empty.
+cli_err cli_glob_literal_level(const cli_glob_list* dirs,
+                               char* comp,
+                               bool last,
+                               bool slash,
+                               cli_glob_list* next) {
+  size_t k = 0;
+  for (size_t i = 0; comp[i] != '\0'; i++) {
+    if (comp[i] == '\\' && comp[i + 1] != '\0') {
+      i++;
+    }
+    comp[k++] = comp[i];
+  }
+  comp[k] = '\0';
+
+  for (size_t i = 0; i < dirs->n; i++) {
+    char* path = cli_glob_join(dirs->items[i], comp, slash);
+    if (path == NULL) {
+      return CLI_OUT_OF_MEMORY;
+    }
+    struct stat st;
+    if (last && (lstat(path, &st) != 0 ||
+                 (slash && (stat(path, &st) != 0 || !S_ISDIR(st.st_mode))))) {
+      free(path);
+      continue;
+    }
+    if (!cli_glob_list_push(next, path)) {
+      free(path);
+      return CLI_OUT_OF_MEMORY;
+    }
+  }
   return CLI_OK;
 }
 
-void cli_cleanup(cli_command* cli) {
-  if (cli->opts != NULL) {
-    cli_opts_cleanup(cli->opts);
-    free(cli->opts);
+// every path matching `pattern` (modified in place) into `out`, at most
+// `budget` of them. CLI_GLOB_LIMIT if there are more.
+cli_err cli_glob_walk(char* pattern, size_t budget, cli_glob_list* out) {
+  size_t len = strlen(pattern);
+  bool trailing = len > 0 && pattern[len - 1] == '/';
+  cli_glob_list cur = {0};
+  char* root = (char*)malloc(2);
+  if (root == NULL) {
+    return CLI_OUT_OF_MEMORY;
+  }
+  strcpy(root, pattern[0] == '/' ? "/" : "");
+  if (!cli_glob_list_push(&cur, root)) {
+    free(root);
+    return CLI_OUT_OF_MEMORY;
   }
 
-  if (cli->args != NULL) {
-    cli_args_cleanup(cli->args);
-    free(cli->args);
+  cli_err err = CLI_OK;
+  char* comp = pattern;
+  while (err == CLI_OK && cur.n > 0) {
+    comp += strspn(comp, "/");
+    if (*comp == '\0') {
+      break;
+    }
+    char* end = comp + strcspn(comp, "/");
+    bool last = end[strspn(end, "/")] == '\0';
+    *end = '\0';
+
+    cli_glob_list next = {0};
+    if (cli_glob_magic(comp)) {
+      cli_glob_level lv = {.dirs = &cur,
+                           .comp = comp,
+                           .want_dir = !last || trailing,
+                           .slash = last && trailing,
+                           .budget = budget};
+      err = cli_glob_read_level(&lv, &next);
+    } else {
+      err = cli_glob_literal_level(&cur, comp, last, last && trailing, &next);
+    }
+    cli_glob_list_free(&cur);
+    cur = next;
+    if (last) {
+      break;
+    }
+    comp = end + 1;
   }
 
-  if (cli->sb != NULL) {
-    str_boxes_cleanup(cli->sb);
-    free(cli->sb);
+  if (err != CLI_OK) {
+    cli_glob_list_free(&cur);
+    return err;
   }
+  *out = cur;
+  return CLI_OK;
 }
 
-void cli_command_destroy(cli_command* c) {
-  cli_cleanup(c);
-  free(c);
+int cli_glob_cmp(const void* a, const void* b) {
+  return strcmp(*(char* const*)a, *(char* const*)b);
 }
 
-// high level API for adding options and arguments
+cli_err cli_feed_glob(cli_command* cli, const char* token, size_t len) {
+  cli_globs* globs = &cli->globs;
+  char* pattern = (char*)malloc(len + 1);
+  if (pattern == NULL) {
+    return CLI_OUT_OF_MEMORY;
+  }
+  memcpy(pattern, token, len);
+  pattern[len] = '\0';
 
-cli_err cli_add_flag(cli_command* cli,
-                     const char* name,
-                     const char* usage,
-                     bool* value) {
-  return cli_opts_add(cli->opts, name, usage, bool_opt_parser, (void*)value,
-                      false, true);
+  cli_glob_list found = {0};
+  cli_err err =
+      cli_glob_walk(pattern, CLI_MAX_GLOB_MATCHES - globs->matches, &found);
+  free(pattern);
+
+  cli_parser* p = &cli->parser;
+  cli_tok t = {.kind = CLI_TOK_POSITIONAL, .len = len};
+  if (err == CLI_GLOB_LIMIT) {
+    p->idx++;
+    p->err_idx = p->idx;
+    p->err_token = token;
+    p->err_len = len;
+    return CLI_GLOB_LIMIT;
+  }
+  if (err != CLI_OK) {
+    return err;
+  }
+  // like a shell, a pattern without matches comes back as itself
+  if (found.n == 0) {
+    cli_glob_list_free(&found);
+    return cli_parser_feed_tok(p, cli->opts, cli->args, token, &t);
+  }
+
+  // the store takes the matches over before any of them is fed
+  qsort((void*)found.items, found.n, sizeof(char*), cli_glob_cmp);
+  size_t first = globs->paths.n;
+  for (size_t i = 0; i < found.n; i++) {
+    if (!cli_glob_list_push(&globs->paths, found.items[i])) {
+      for (; i < found.n; i++) {
+        free(found.items[i]);
+      }
+      free((void*)found.items);
+      return CLI_OUT_OF_MEMORY;
+    }
+  }
+  globs->matches += found.n;
+  free((void*)found.items);
+
+  int idx = p->idx;
+  for (size_t i = first; i < globs->paths.n && err == CLI_OK; i++) {
+    const char* path = globs->paths.items[i];
+    t.len = strlen(path);
+    err = cli_parser_feed_tok(p, cli->opts, cli->args, path, &t);
+  }
+  // a failed match is reported at the index of its pattern
+  p->idx = idx + 1;
+  if (err != CLI_OK) {
+    p->err_idx = p->idx;
+  }
+  return err;
 }
 
-cli_err cli_add_int_argument(cli_command* cli, int* value) {
-  return cli_args_add(cli->args, int_arg_parser, (void*)value);
+cli_err cli_feed_tok(cli_command* cli,
+                     const char* token,
+                     const cli_tok* t,
+                     bool may_glob) {
+  if (may_glob && cli_glob_target(cli, token, t)) {
+    cli->err = cli_feed_glob(cli, token, t->len);
+  } else {
+    cli->err =
+        cli_parser_feed_tok(&cli->parser, cli->opts, cli->args, token, t);
+  }
+  return cli->err;
 }
 
-cli_err cli_add_int_option(cli_command* cli,
-                           const char* name,
-                           const char* usage,
-                           int* value,
-                           bool required) {
-  return cli_opts_add(cli->opts, name, usage, int_opt_parser, (void*)value,
-                      required, false);
+cli_err cli_feed(cli_command* cli, const char* token, size_t len) {
+  cli_tok t;
+  cli_parser_classify(&cli->parser, token, len, &t);
+  return cli_feed_tok(cli, token, &t, true);
 }
 
-cli_err cli_add_float_argument(cli_command* cli, float* value) {
-  return cli_args_add(cli->args, float_arg_parser, (void*)value);
+cli_err cli_finish(cli_command* cli) {
+  cli->err = cli_parser_finish(&cli->parser, cli->opts, cli->args);
+  if (cli->err == CLI_OK) {
+    cli->err = cli_check_paths(cli);
+  }
+  if (cli->err == CLI_OK && cli->args->streamed) {
+    cli_arg* last = cli->args->args[cli->args->idx - 1];
+    cli->err = cli_stream_run(&cli->stream, last);
+  }
+  return cli->err;
 }
 
-cli_err cli_add_float_option(cli_command* cli,
-                             const char* name,
-                             const char* usage,
-                             float* value,
-                             bool required) {
-  return cli_opts_add(cli->opts, name, usage, float_opt_parser, (void*)value,
-                      required, false);
+// single line parsing
+
+bool cli_is_blank(char ch) {
+  return ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r';
 }
 
-cli_err cli_add_str_argument(cli_command* cli, char* value, size_t buf_size) {
-  cli_err err;
-  str_box* box = NULL;
+// split `line` with POSIX shell quoting rules and feed each word as it ends.
+// words are unquoted by compacting them in place (the write cursor never
+// passes the read cursor), so there is no allocation and no second pass.
+cli_err cli_parse_line(cli_command* cli, char* line, size_t len) {
+  cli_begin(cli);
 
-  if ((err = str_boxes_add(cli->sb, value, buf_size, &box)) != CLI_OK) {
-    return err;
+  size_t r = 0;
+  for (;;) {
+    while (r < len && cli_is_blank(line[r])) {
+      r++;
+    }
+    if (r == len) {
+      break;
+    }
+
+    size_t start = r;
+    size_t w = r;
+    char quote = '\0';
+    for (; r < len; r++) {
+      char ch = line[r];
+
+      // everything is literal inside single quotes
+      if (quote == '\'') {
+        if (ch == '\'') {
+          quote = '\0';
+        } else {
+          line[w++] = ch;
+        }
+        continue;
+      }
+
+      // inside double quotes a backslash only escapes " \ $ and `
+      if (quote == '"') {
+        if (ch == '"') {
+          quote = '\0';
+        } else if (ch == '\\' && r + 1 < len &&
+                   (line[r + 1] == '"' || line[r + 1] == '\\' ||
+                    line[r + 1] == '$' || line[r + 1] == '`')) {
+          line[w++] = line[++r];
+        } else {
+          line[w++] = ch;
+        }
+        continue;
+      }
+
+      if (ch == '\'' || ch == '"') {
+        quote = ch;
+      } else if (ch == '\\') {
+        if (r + 1 == len) {
+          cli->err = CLI_BAD_QUOTING;
+          return cli->err;
+        }
+        // an escaped newline continues the line
+        r++;
+        if (line[r] != '\n') {
+          line[w++] = line[r];
+        }
+      } else if (cli_is_blank(ch)) {
+        break;
+      } else {
+        line[w++] = ch;
+      }
+    }
+
+    if (quote != '\0') {
+      cli->err = CLI_BAD_QUOTING;
+      return cli->err;
+    }
+
+    // quoting or escaping anywhere keeps a word from being expanded
+    cli_tok t;
+    cli_parser_classify(&cli->parser, line + start, w - start, &t);
+    cli_err err = cli_feed_tok(cli, line + start, &t, w == r);
+    if (err != CLI_OK) {
+      return err;
+    }
   }
 
-  return cli_args_add(cli->args, str_arg_parser, (void*)box);
+  return cli_finish(cli);
 }
 
-cli_err cli_add_str_option(cli_command* cli,
-                           const char* name,
-                           const char* usage,
-                           char* value,
-                           bool required,
-                           size_t buf_size) {
-  cli_err err;
-  str_box* box = NULL;
+// completion
 
-  if ((err = str_boxes_add(cli->sb, value, buf_size, &box)) != CLI_OK) {
-    return err;
+// print every option whose name starts with `partial` as it would be typed.
+// candidates come from a contiguous run in the sorted index.
+void cli_complete(cli_command* cli, const char* partial) {
+  if (cli->opts == NULL) {
+    return;
   }
 
-  return cli_opts_add(cli->opts, name, usage, str_opt_parser, (void*)box,
-                      required, false);
+  // the word under the cursor may already carry its dashes
+  if (strncmp(partial, "--", 2) == 0) {
+    partial += 2;
+  } else if (strncmp(partial, "-", 1) == 0) {
+    partial += 1;
+  }
+
+  size_t len = strlen(partial);
+  for (size_t g = 0; g <= cli->opts->n_shared; g++) {
+    cli_opts* o = cli_opts_at(cli->opts, g);
+    for (size_t i = cli_opts_lower_bound(o, partial, len); i < o->idx; i++) {
+      const char* name = o->sorted[i]->name;
+      if (strncmp(name, partial, len) != 0) {
+        break;
+      }
+      printf("%s%s\n", strlen(name) == 1 ? "-" : "--", name);
+    }
+  }
 }
 
-void cli_print_help_and_exit(cli_command* cli, int status) {
-  char buf[1024];
+// shell function names can't carry most of what shows up in argv[0]
+void cli_completion_func_name(const char* prog, char* buf, size_t sz) {
+  size_t i = 0;
+  for (; prog[i] != '\0' && i + 1 < sz; i++) {
+    char ch = prog[i];
+    bool ok = (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') ||
+              (ch >= '0' && ch <= '9');
+    buf[i] = ok ? ch : '_';
+  }
+  buf[i] = '\0';
+}
 
-  char initial[] =
-      "%s\n\nUsage:\n\t%s %s\nOptions:\n\t-h,--help\tPrint usage and exit.\n";
+void cli_print_completion_script(cli_command* cli, cli_shell shell) {
+  // complete against the basename so installs under any prefix work
+  const char* prog = cli->argv[0];
+  const char* slash = strrchr(prog, '/');
+  if (slash != NULL) {
+    prog = slash + 1;
+  }
 
-  snprintf(buf, 1024, initial, cli->desc, cli->argv[0], cli->usage);
+  char func[CLI_OPT_TOKEN_MAX_LEN];
+  cli_completion_func_name(prog, func, CLI_OPT_TOKEN_MAX_LEN);
+
+  if (shell == CLI_SHELL_ZSH) {
+    printf("#compdef %s\n_%s() {\n  compadd --", prog, func);
+  } else {
+    printf(
+        "_%s() {\n  local cur=\"${COMP_WORDS[COMP_CWORD]}\"\n"
+        "  COMPREPLY=($(compgen -W \"",
+        func);
+  }
 
-  // check for options and append
+  // the option list is baked in so the shell never has to run the binary
   if (cli->opts != NULL) {
-    for (size_t i = 0; i < cli->opts->idx; i++) {
-      const char* name = cli->opts->opts[i]->name;
-      // printf("NAME: %s\n", name);
-      if ((strcmp(name, "help") == 0) || (strcmp(name, "h") == 0)) {
-        continue;
+    for (size_t g = 0; g <= cli->opts->n_shared; g++) {
+      cli_opts* o = cli_opts_at(cli->opts, g);
+      cli_opts_build_index(o);
+      for (size_t i = 0; i < o->idx; i++) {
+        const char* name = o->sorted[i]->name;
+        printf(" %s%s", strlen(name) == 1 ? "-" : "--", name);
       }
-      char opt_buf[CLI_OPT_TOKEN_MAX_LEN + CLI_OPT_USAGE_MAX_LEN];
-      cli_opt_print_message(cli->opts->opts[i], opt_buf);
-      strcat(buf, opt_buf);
     }
   }
 
-  fprintf(stderr, "%s\n", buf);
-  exit(status);
+  if (shell == CLI_SHELL_ZSH) {
+    printf("\n}\ncompdef _%s %s\n", func, prog);
+  } else {
+    printf(" \" -- \"$cur\"))\n}\ncomplete -o default -F _%s %s\n", func,
+           prog);
+  }
 }
 
 cli_err cli_parse(cli_command* cli) {
-  cli_err err = cli_parse_loop(cli->opts, cli->args, cli->argc, cli->argv);
+  // hidden completion mode answers straight from the option table and exits
+  // before any application code that follows registration.
+  if (!cli->embedded && cli->argc > 1 &&
+      strcmp(cli->argv[1], CLI_COMPLETE_CMD) == 0) {
+    cli_complete(cli, cli->argc > 2 ? cli->argv[2] : "");
+    exit(0);
+  }
+
+  cli_begin(cli);
+
+  // classify the whole of argv in one sweep into packed kind words and
+  // lengths, then dispatch on the kinds
+  size_t n = cli->argc > 1 ? (size_t)cli->argc - 1 : 0;
+  size_t small_lens[CLI_MAX_ARGS];
+  uint32_t small_words[CLI_MAX_ARGS];
+  size_t* lens = small_lens;
+  uint32_t* words = small_words;
+  if (n > CLI_MAX_ARGS) {
+    lens = (size_t*)malloc(n * (sizeof(size_t) + sizeof(uint32_t)));
+    if (lens == NULL) {
+      cli->err = CLI_OUT_OF_MEMORY;
+      return cli->err;
+    }
+    words = (uint32_t*)(lens + n);
+  }
 
-  if (err == CLI_PRINT_HELP_AND_EXIT) {
+  for (size_t i = 0; i < n; i++) {
+    const char* token = cli->argv[i + 1];
+    size_t eq;
+    cli_tok t;
+    lens[i] = cli_scan_token(token, &eq);
+    cli_classify(token, lens[i], eq, &t);
+    words[i] = cli_tok_pack(&t);
+  }
+
+  cli_err err = CLI_OK;
+  for (size_t i = 0; i < n && err == CLI_OK; i++) {
+    cli_tok t;
+    cli_tok_unpack(words[i], lens[i], &t);
+    err = cli_feed_tok(cli, cli->argv[i + 1], &t, true);
+  }
+
+  if (lens != small_lens) {
+    free(lens);
+  }
+
+  if (err == CLI_OK) {
+    err = cli_finish(cli);
+  }
+
+  if (err == CLI_PRINT_HELP_AND_EXIT && !cli->embedded) {
     cli_print_help_and_exit(cli, 0);
   }
 
   return err;
+}
+
+// struct parsing
+// cli_parse_into keeps its state in a cli_into on the caller's stack and only
+// reads the command, so any number of calls can run at once.
+
+typedef struct cli_into {
+  const cli_binding* b;
+  unsigned char* base;           // the caller's struct
+  uint64_t seen[CLI_OPT_WORDS];  // own options given, by index
+  const cli_field* pending;      // field waiting for its value token
+  size_t arg_i;                  // next positional argument to fill
+  bool args_only;                // the options are over
+} cli_into;
+
+// convert a token into the field's place in the caller's struct
+cli_err cli_into_store(cli_into* in,
+                       const cli_field* f,
+                       const char* token,
+                       size_t len) {
+  void* out = in->base + f->offset;
+  switch (f->type) {
+    case CLI_FIELD_FLAG:
+      // a switch flips its default, as bool_opt_parser does
+      *(bool*)out = !*(bool*)out;
+      return CLI_OK;
+    case CLI_FIELD_INT:
+      return cli_parse_int(token, len, (int*)out);
+    case CLI_FIELD_FLOAT:
+      return cli_parse_float(token, len, (float*)out);
+    case CLI_FIELD_STR:
+      return cli_parse_str(token, len, f->str, (char*)out);
+    case CLI_FIELD_SIZE:
+      return cli_parse_size(token, len, (uint64_t*)out);
+    case CLI_FIELD_DURATION:
+      return cli_parse_duration(token, len, (int64_t*)out);
+  }
+  return CLI_TYPE_MISMATCH;
+}
+
+// leave option mode with the checks of cli_parser_end_opts on the local
+// seen set. group options are never fields, so they are never seen here.
+cli_err cli_into_end_opts(cli_into* in, cli_opts* opts) {
+  in->args_only = true;
+  for (size_t g = 0; g <= opts->n_shared; g++) {
+    cli_opts* o = cli_opts_at(opts, g);
+    for (size_t i = 0; i < o->idx; i++) {
+      bool seen = g == 0 && ((in->seen[i / 64] >> (i % 64)) & 1) != 0;
+      if (o->opts[i]->required && !seen) {
+        return CLI_UNSEEN_REQ_OPTS;
+      }
+    }
+  }
+
+  const cli_constraint* violated;
+  return cli_opts_check_seen(opts, in->seen, &violated);
+}
+
+cli_err cli_into_feed_arg(cli_into* in,
+                          cli_args* args,
+                          const char* token,
+                          size_t len) {
+  if (in->arg_i == args->idx - (args->streamed ? 1 : 0)) {
+    return CLI_ARG_COUNT;
+  }
+
+  cli_arg* arg = args->args[in->arg_i];
+  in->arg_i++;
+  if (arg->field == 0) {
+    return CLI_NOT_BOUND;
+  }
+  return cli_into_store(in, &in->b->fields[arg->field - 1], token, len);
+}
+
+cli_err cli_into_feed_opt(cli_into* in,
+                          cli_command* cli,
+                          const char* token,
+                          const cli_tok* t) {
+  switch ((cli_tok_kind)t->kind) {
+    case CLI_TOK_TERMINATOR:
+      return cli_into_end_opts(in, cli->opts);
+    case CLI_TOK_POSITIONAL: {
+      cli_err err = cli_into_end_opts(in, cli->opts);
+      if (err != CLI_OK) {
+        return err;
+      }
+      return cli_into_feed_arg(in, cli->args, token, t->len);
+    }
+    // reported, never acted on: the caller decides what help means
+    case CLI_TOK_HELP:
+      return CLI_PRINT_HELP_AND_EXIT;
+    case CLI_TOK_SHORT:
+    case CLI_TOK_LONG:
+      break;
+  }
+
+  const char* name = token + t->dashes;
+  size_t end = t->eq != 0 ? t->eq : t->len;
+  size_t name_len = end - t->dashes;
+
+  cli_opt* opt;
+  cli_err err = cli_opts_lookup(cli->opts, name, name_len, &opt);
+  if (err != CLI_OK) {
+    return err;
+  }
+  if (t->eq == 0 && opt->name[name_len] != '\0' &&
+      strcmp(opt->name, "help") == 0) {
+    return CLI_PRINT_HELP_AND_EXIT;
+  }
+
+  // only fields have a place in the struct
+  if (opt->field == 0) {
+    return CLI_NOT_BOUND;
+  }
+  const cli_field* f = &in->b->fields[opt->field - 1];
+
+  uint64_t bit = UINT64_C(1) << (f->slot % 64);
+  if ((in->seen[f->slot / 64] & bit) != 0) {
+    return CLI_ALREADY_SEEN;
+  }
+  in->seen[f->slot / 64] |= bit;
+
+  if (f->type == CLI_FIELD_FLAG) {
+    return cli_into_store(in, f, NULL, 0);
+  }
+  if (t->eq != 0) {
+    return cli_into_store(in, f, token + end + 1, t->len - end - 1);
+  }
+  in->pending = f;
+  return CLI_OK;
+}
+
+cli_err cli_parse_into(cli_command* cli, int argc, char** argv, void* cfg) {
+  cli_binding* b = cli->binding;
+  if (b == NULL) {
+    return CLI_NOT_BOUND;
+  }
+
+  // lookups only read the sorted indexes once they are built
+  pthread_mutex_lock(&b->lock);
+  for (size_t g = 0; g <= cli->opts->n_shared; g++) {
+    cli_opts_build_index(cli_opts_at(cli->opts, g));
+  }
+  pthread_mutex_unlock(&b->lock);
+
+  cli_into in;
+  in.b = b;
+  in.base = (unsigned char*)cfg;
+  memset(in.seen, 0, sizeof(in.seen));
+  in.pending = NULL;
+  in.arg_i = 0;
+  in.args_only = false;
+  memcpy(cfg, b->image, b->size);
+
+  cli_err err = CLI_OK;
+  for (int i = 1; i < argc && err == CLI_OK; i++) {
+    const char* token = argv[i];
+    size_t eq;
+    size_t len = cli_scan_token(token, &eq);
+    if (in.pending != NULL) {
+      const cli_field* f = in.pending;
+      in.pending = NULL;
+      err = cli_into_store(&in, f, token, len);
+    } else if (in.args_only) {
+      err = cli_into_feed_arg(&in, cli->args, token, len);
+    } else {
+      cli_tok t;
+      cli_classify(token, len, eq, &t);
+      err = cli_into_feed_opt(&in, cli, token, &t);
+    }
+  }
+  if (err != CLI_OK) {
+    return err;
+  }
+
+  // an option at the very end never got its value
+  if (in.pending != NULL) {
+    return CLI_OUT_OF_BOUNDS;
+  }
+  if (!in.args_only && (err = cli_into_end_opts(&in, cli->opts)) != CLI_OK) {
+    return err;
+  }
+
+  cli_args* args = cli->args;
+  if (in.arg_i != args->idx - (args->variadic || args->streamed ? 1 : 0)) {
+    return CLI_ARG_COUNT;
+  }
+  return CLI_OK;
 }
\ No newline at end of file
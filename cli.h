@@ -15,6 +15,7 @@
 extern "C" {
 #endif
 
+#include <stdint.h>
 #include <stdlib.h>
 
 // The max length for all tokens
@@ -37,6 +38,42 @@ extern "C" {
 #define CLI_MAX_ARGS 64
 #endif
 
+// Max number of option groups attached to one command
+#ifndef CLI_MAX_GROUPS
+#define CLI_MAX_GROUPS 8
+#endif
+
+// argv[1] token that puts cli_parse in shell completion mode
+#ifndef CLI_COMPLETE_CMD
+#define CLI_COMPLETE_CMD "__complete"
+#endif
+
+// Max threads used to check path expectations after a parse
+#ifndef CLI_PATH_THREADS
+#define CLI_PATH_THREADS 8
+#endif
+
+// Max paths that glob patterns may expand to in one parse
+#ifndef CLI_MAX_GLOB_MATCHES
+#define CLI_MAX_GLOB_MATCHES (1 << 20)
+#endif
+
+// Max threads reading directories for one level of a glob pattern
+#ifndef CLI_GLOB_THREADS
+#define CLI_GLOB_THREADS 8
+#endif
+
+// Read size for an argument streamed from a file descriptor, and so the
+// longest record it can take
+#ifndef CLI_STREAM_CHUNK
+#define CLI_STREAM_CHUNK (1 << 16)
+#endif
+
+// Max edit distance for option suggestions
+#ifndef CLI_SUGGEST_MAX_DIST
+#define CLI_SUGGEST_MAX_DIST 2
+#endif
+
 #define CLI_UNUSED(x) (void)(x)
 
 #define CLI_CHECK_MEM_ALLOC(value)       \
@@ -62,15 +99,49 @@ typedef enum cli_err {
   CLI_ARG_COUNT,
   CLI_PRINT_HELP_AND_EXIT,
   CLI_TOKEN_TOO_LONG,
-  CLI_USAGE_STR_TOO_LONG
+  CLI_USAGE_STR_TOO_LONG,
+  CLI_AMBIGUOUS_OPT,
+  CLI_PARSE_FAILED_CHOICE,
+  CLI_PARSE_FAILED_CUSTOM,
+  CLI_PARSE_FAILED_SIZE,
+  CLI_PARSE_FAILED_DURATION,
+  CLI_TYPE_MISMATCH,
+  CLI_BAD_QUOTING,
+  CLI_BAD_SNAPSHOT,
+  CLI_EXCLUSIVE_OPTS,
+  CLI_UNMET_REQUIRES,
+  CLI_UNSEEN_ONE_OF,
+  CLI_PARSE_FAILED_UTF8,
+  CLI_BAD_PATHS,
+  CLI_GLOB_LIMIT,
+  CLI_PARSE_FAILED_FILE,
+  CLI_PARSE_FAILED_RANGE,
+  CLI_RANGE_OVERLAP,
+  CLI_RANGE_OUT_OF_BOUNDS,
+  CLI_PARSE_FAILED_KV,
+  CLI_DUPLICATE_KEY,
+  CLI_STREAM_FAILED,
+  CLI_STREAM_RECORD_TOO_LONG,
+  CLI_OUT_OF_MEMORY,
+  CLI_NOT_BOUND,
+  CLI_ALREADY_BOUND,
+  CLI_BAD_CHOICES,
+  CLI_BAD_GROUP
 } cli_err;
 
+// A static description of `err`, like "token parse failed for integer.".
+const char* cli_err_str(cli_err err);
+
 void cli_print_err(cli_err err);
 
 typedef struct cli_command cli_command;
 
 cli_command* cli_command_new(void);
 
+// Like cli_command_new but NULL when out of memory instead of exiting.
+// Everything else returns CLI_OUT_OF_MEMORY (or NULL for constructors).
+cli_command* cli_command_try_new(void);
+
 void cli_command_destroy(cli_command* cli);
 
 cli_err cli_init(cli_command* cli,
@@ -81,6 +152,64 @@ cli_err cli_init(cli_command* cli,
 
 void cli_cleanup(cli_command* cli);
 
+// Option groups: a set of options registered once with the usual cli_add_*
+// calls and attached by reference to any number of commands. Lookups check
+// the command's own options first, then each group in attach order. Groups
+// are reference counted: cli_command_destroy releases the caller's reference
+// and each command it is attached to releases its own. Since the group's
+// targets and seen flags are shared, commands using a group should not be
+// parsed concurrently. NULL when out of memory. Attaching a group twice, or
+// a command to itself, fails with CLI_BAD_GROUP.
+cli_command* cli_group_new(void);
+cli_err cli_add_group(cli_command* cli, cli_command* group);
+
+// Accept unambiguous prefixes of option names, e.g. `--verb` for `--verbose`.
+// Off by default. A prefix shared by several options fails with
+// CLI_AMBIGUOUS_OPT.
+void cli_allow_abbrev(cli_command* cli, bool allow);
+
+// Lazy mode: cli_parse only tokenizes and looks options up, keeping each value
+// as a slice of argv. Conversion happens on first access through the getters
+// below and the result is cached, so parse errors for option values surface
+// there instead of from cli_parse. Positional arguments are still converted by
+// cli_parse.
+void cli_set_lazy(cli_command* cli, bool lazy);
+
+// Expand positionals with glob(7) wildcards (`*`, `?`, `[`) that fill a
+// string or path argument, like a shell would for a program exec'd without
+// one. Each match is fed as its own positional in sorted order, so a variadic
+// path argument takes all of them; a pattern without matches is kept as is.
+// Off by default. Directories are read one pattern component at a time, up to
+// CLI_GLOB_THREADS of them at once. More than CLI_MAX_GLOB_MATCHES matches in
+// one parse, or directories on the way to them, fails with CLI_GLOB_LIMIT as
+// soon as the walk gets there. cli_parse_line leaves words with any quoting
+// alone.
+void cli_expand_globs(cli_command* cli, bool expand);
+
+// Reject string option and argument values that are not well formed UTF-8
+// with CLI_PARSE_FAILED_UTF8. Off by default. Covers the strings registered
+// on this command, before or after the call; a group has its own setting.
+void cli_require_utf8(cli_command* cli, bool require);
+
+// Constraints between options, checked together with the required options
+// once the options end. Names refer to options registered on the command
+// itself (not its groups) and must be added before the constraint.
+// cli_add_exclusive: at most one of `names` (CLI_EXCLUSIVE_OPTS)
+// cli_add_requires: `name` needs every one of `needs` (CLI_UNMET_REQUIRES)
+// cli_add_one_of: at least one of `names` (CLI_UNSEEN_ONE_OF)
+cli_err cli_add_exclusive(cli_command* cli,
+                          const char* const* names,
+                          size_t n);
+cli_err cli_add_requires(cli_command* cli,
+                         const char* name,
+                         const char* const* needs,
+                         size_t n);
+cli_err cli_add_one_of(cli_command* cli, const char* const* names, size_t n);
+
+// A description of the constraint the last parse violated, like
+// "--input, --stdin are mutually exclusive", or NULL.
+const char* cli_violated_constraint(cli_command* cli);
+
 // high level API for adding options and arguments
 
 cli_err cli_add_flag(cli_command* cli,
@@ -113,10 +242,382 @@ cli_err cli_add_str_option(cli_command* cli,
                            bool required,
                            size_t buf_size);
 
+// Sets `value` to the index of the matching entry in `choices`. The `choices`
+// array must outlive the command. Tokens outside the set fail with
+// CLI_PARSE_FAILED_CHOICE. An empty or repeated set fails with
+// CLI_BAD_CHOICES.
+cli_err cli_add_choice_option(cli_command* cli,
+                              const char* name,
+                              const char* usage,
+                              const char* const* choices,
+                              size_t n,
+                              int* value,
+                              bool required);
+
+// Byte counts like `512`, `64MiB`, `1.5G` or `10KB`. K, M, G, T, P, E and
+// their `i`/`iB` forms are powers of 1024, the `B` forms powers of 1000.
+cli_err cli_add_size_option(cli_command* cli,
+                            const char* name,
+                            const char* usage,
+                            uint64_t* value,
+                            bool required);
+
+// Durations in nanoseconds like `250ms`, `2h` or `1h30m`. Units are ns, us, ms,
+// s, m, h and d.
+cli_err cli_add_duration_option(cli_command* cli,
+                                const char* name,
+                                const char* usage,
+                                int64_t* value,
+                                bool required);
+
+// User parse callback for types the library does not know about. Decode the
+// `len` byte `token` into `ctx` and return CLI_OK, or an error such as
+// CLI_PARSE_FAILED_CUSTOM which cli_parse hands back unchanged.
+typedef cli_err (*cli_custom_parser)(const char* token, size_t len, void* ctx);
+
+cli_err cli_add_custom_option(cli_command* cli,
+                              const char* name,
+                              const char* usage,
+                              cli_custom_parser parser,
+                              void* ctx,
+                              bool required);
+
+cli_err cli_add_custom_argument(cli_command* cli,
+                                cli_custom_parser parser,
+                                void* ctx);
+
 void cli_print_help_and_exit(cli_command* cli, int status);
 
+// shell completion
+
+typedef enum cli_shell { CLI_SHELL_BASH = 0, CLI_SHELL_ZSH } cli_shell;
+
+// Print a completion script with the registered options precomputed to stdout.
+void cli_print_completion_script(cli_command* cli, cli_shell shell);
+
 cli_err cli_parse(cli_command* cli);
 
+// Incremental parsing for command lines that arrive one token at a time.
+// cli_begin resets the command: flag, number, string, choice, size and
+// duration options go back to the values their targets held before the
+// first parse, so each line starts from the defaults. cli_feed pushes the
+// next token (`len` bytes, without the program name, no NUL required) and
+// cli_finish runs the end of line checks. Values are converted as soon as
+// their token is fed. Help comes back as CLI_PRINT_HELP_AND_EXIT instead of
+// exiting. In lazy mode, or for cli_unknown_token, fed tokens have to stay
+// valid until they are used.
+void cli_begin(cli_command* cli);
+cli_err cli_feed(cli_command* cli, const char* token, size_t len);
+cli_err cli_finish(cli_command* cli);
+
+// Parse the arguments (no program name) held in one string, split with POSIX
+// shell quoting: blanks separate words, single quotes are literal, double
+// quotes only honor backslash before `"`, `\`, `$` and backquote, and a
+// backslash escapes the next character elsewhere. Words are unquoted in place
+// inside `line` and fed straight to the parser, so `line` is modified and must
+// outlive any lazy values. Unbalanced quotes fail with CLI_BAD_QUOTING. Like
+// cli_begin, every call starts from the defaults.
+cli_err cli_parse_line(cli_command* cli, char* line, size_t len);
+
+// Path options and arguments. The value is a NUL terminated copy of the
+// token that stays valid until the next parse or cleanup. Expectations are
+// or'd together and checked for every path of the parse at once when it
+// finishes, spread over up to CLI_PATH_THREADS threads. If any path fails,
+// the parse returns CLI_BAD_PATHS and cli_bad_path lists each failure.
+typedef enum cli_path_expect {
+  CLI_PATH_ANY = 0,
+  CLI_PATH_EXISTS = 1 << 0,
+  CLI_PATH_FILE = 1 << 1,     // a regular file
+  CLI_PATH_DIR = 1 << 2,      // a directory
+  CLI_PATH_READABLE = 1 << 3  // readable, see access(2)
+} cli_path_expect;
+
+cli_err cli_add_path_option(cli_command* cli,
+                            const char* name,
+                            const char* usage,
+                            const char** value,
+                            unsigned expect,
+                            bool required);
+cli_err cli_add_path_argument(cli_command* cli,
+                              const char** value,
+                              unsigned expect);
+
+// Every remaining positional (zero or more) as one array of paths. Must be
+// the last argument registered, later ones fail with CLI_ARG_COUNT.
+cli_err cli_add_path_arguments(cli_command* cli,
+                               const char*** values,
+                               size_t* n,
+                               unsigned expect);
+
+// The number of paths that failed their checks in the last parse. Failures
+// of the command's own paths come first, then those of each attached group
+// in attach order; within one, in the order the values were converted,
+// which is argv order unless the command is lazy.
+size_t cli_bad_path_count(cli_command* cli);
+
+// The i-th failed path, and in `err` (if not NULL) why as an errno value:
+// what stat(2) or access(2) reported, EISDIR or EINVAL for a path that is not
+// a regular file, ENOTDIR for one that is not a directory.
+const char* cli_bad_path(cli_command* cli, size_t i, int* err);
+
+// Streams the last registered argument from `fd` instead of argv, for
+// pipelines like `find -print0 | myapp`. Once the options and the other
+// positionals are done, the parse reads `fd` to its end in CLI_STREAM_CHUNK
+// blocks. Each record ending in `delim` (usually '\0' or '\n') goes through
+// the argument's own parser into its value and then to `cb` with its index,
+// so memory stays the same whatever the input size. Empty records are
+// skipped and the last record may lack its delimiter.
+//
+// A parser error, or anything but CLI_OK from `cb`, stops the stream and is
+// what the parse returns; cli_streamed then gives the failing record's
+// index. Path arguments can't be streamed (CLI_TYPE_MISMATCH), and no
+// argument can be registered after this one.
+typedef cli_err (*cli_stream_cb)(void* ctx, size_t i);
+
+cli_err cli_stream_arguments(cli_command* cli,
+                             int fd,
+                             char delim,
+                             cli_stream_cb cb,
+                             void* ctx);
+
+// Records of the last parse that made it through `cb`.
+size_t cli_streamed(cli_command* cli);
+
+// Struct binding: one registered command filling any number of config
+// structs. Bind the struct type once with its defaults, then register each
+// field by type and offsetof instead of a pointer. cli_parse_into copies the
+// defaults into `cfg` with one memcpy and parses argv into it. Fields must
+// fit in the struct (CLI_OUT_OF_BOUNDS) and have their type's size, any size
+// for a string buffer (CLI_TYPE_MISMATCH). Fields and cli_parse_into before
+// cli_bind_struct fail with CLI_NOT_BOUND, a second bind with
+// CLI_ALREADY_BOUND.
+//
+// cli_parse_into may be called from many threads on one command, each with
+// its own struct: values are written at their offsets in `cfg` and the parse
+// state lives on the caller's stack, so calls run side by side and never
+// touch the command's argv or cli_last_error. Help is returned as
+// CLI_PRINT_HELP_AND_EXIT, never printed. Options and arguments that are not
+// fields fail with CLI_NOT_BOUND. A plain cli_parse or cli_parse_line on the
+// command writes into the defaults, so it changes later structs and must not
+// run alongside.
+typedef enum cli_field_type {
+  CLI_FIELD_FLAG = 0,  // bool, options only
+  CLI_FIELD_INT,       // int
+  CLI_FIELD_FLOAT,     // float
+  CLI_FIELD_STR,       // char[size]
+  CLI_FIELD_SIZE,      // uint64_t bytes, options only
+  CLI_FIELD_DURATION   // int64_t nanoseconds, options only
+} cli_field_type;
+
+cli_err cli_bind_struct(cli_command* cli, const void* defaults, size_t size);
+
+cli_err cli_add_field_option(cli_command* cli,
+                             const char* name,
+                             const char* usage,
+                             cli_field_type type,
+                             size_t offset,
+                             size_t size,
+                             bool required);
+cli_err cli_add_field_argument(cli_command* cli,
+                               cli_field_type type,
+                               size_t offset,
+                               size_t size);
+
+cli_err cli_parse_into(cli_command* cli, int argc, char** argv, void* cfg);
+
+// A read only view of bytes owned by the library.
+typedef struct cli_span {
+  const void* ptr;
+  size_t len;
+} cli_span;
+
+// File contents options like `--schema=@schema.json` (the `@` is optional).
+// The file is memory mapped read only during the parse and stays mapped
+// until the next parse or cleanup; files that can't be mapped, like pipes,
+// are read into memory instead. An empty file is a zero length span.
+// CLI_PARSE_FAILED_FILE if the file can't be opened or read.
+cli_err cli_add_file_option(cli_command* cli,
+                            const char* name,
+                            const char* usage,
+                            cli_span* value,
+                            bool required);
+
+// Integer set options like `--cpus=0-7,16-23` or `--shards=1,4,9-200`:
+// comma separated members and inclusive `lo-hi` ranges in any order, every
+// member below `limit`. Ranges are filled 64 members per word, so a parse
+// costs one pass over the limit / 64 words of the set to clear it plus one
+// word per 64 members in each range. Errors: CLI_PARSE_FAILED_RANGE for bad
+// syntax, CLI_RANGE_OVERLAP if a member is given twice and
+// CLI_RANGE_OUT_OF_BOUNDS for a member >= limit.
+
+// Into a bitset of (limit + 63) / 64 words, cleared first.
+cli_err cli_add_bitset_option(cli_command* cli,
+                              const char* name,
+                              const char* usage,
+                              uint64_t* bits,
+                              uint64_t limit,
+                              bool required);
+
+// Into an array of sorted, merged intervals for sparse or large domains.
+// `n` gets the number of intervals; more than `cap` after merging is
+// CLI_RANGE_OUT_OF_BOUNDS as well.
+typedef struct cli_range {
+  uint64_t lo;
+  uint64_t hi;  // inclusive
+} cli_range;
+
+cli_err cli_add_ranges_option(cli_command* cli,
+                              const char* name,
+                              const char* usage,
+                              cli_range* ranges,
+                              size_t cap,
+                              size_t* n,
+                              uint64_t limit,
+                              bool required);
+
+// Repeatable `-D key=value` options collected into a hash table. Keys and
+// values are slices of the tokens as fed (of the blob after
+// cli_snapshot_read), the table is valid until the next parse or cleanup.
+// A token without `=` or with an empty key is CLI_PARSE_FAILED_KV. With
+// CLI_KV_UNIQUE a repeated key is CLI_DUPLICATE_KEY, otherwise the last
+// value wins. Values are always converted during the parse, even in lazy
+// mode.
+typedef enum cli_kv_policy {
+  CLI_KV_LAST_WINS = 0,
+  CLI_KV_UNIQUE
+} cli_kv_policy;
+
+typedef struct cli_kv cli_kv;
+
+cli_err cli_add_kv_option(cli_command* cli,
+                          const char* name,
+                          const char* usage,
+                          const cli_kv** table,
+                          cli_kv_policy policy,
+                          bool required);
+
+// Look up a key in O(1). false if it was not given.
+bool cli_kv_get(const cli_kv* kv, const char* key, size_t len, cli_span* value);
+
+// Number of distinct keys, and the i-th one in the order first given.
+size_t cli_kv_count(const cli_kv* kv);
+void cli_kv_at(const cli_kv* kv, size_t i, cli_span* key, cli_span* value);
+
+// Typed getters. These work in either mode: they convert a pending lazy value
+// into the registered target if needed, then copy it out. An option that was
+// not given yields whatever the target held before the parse.
+// CLI_TYPE_MISMATCH if `name` was registered as another type.
+cli_err cli_get_flag(cli_command* cli, const char* name, bool* out);
+cli_err cli_get_int(cli_command* cli, const char* name, int* out);
+cli_err cli_get_float(cli_command* cli, const char* name, float* out);
+cli_err cli_get_str(cli_command* cli, const char* name, const char** out);
+
+// Convert a pending lazy value of any type into its registered target.
+cli_err cli_resolve(cli_command* cli, const char* name);
+
+// Deferred actions: work tied to an option, like loading the file it names,
+// that cli_parse does not run inline. cli_run_actions runs the action of every
+// option seen in the last parse on up to `n_threads` threads (the caller is
+// one of them, 0 or 1 runs them in order), after any lazy values are
+// converted. Actions are treated as independent and must be safe to run
+// concurrently. Returns the error of the first failed action in registration
+// order.
+typedef cli_err (*cli_action)(void* ctx);
+
+cli_err cli_add_action(cli_command* cli,
+                       const char* name,
+                       cli_action action,
+                       void* ctx);
+cli_err cli_run_actions(cli_command* cli, size_t n_threads);
+
+// Parse snapshots: the result of a successful parse as a compact, versioned,
+// pointer free blob that can be handed to a worker through a pipe or memfd.
+// The worker registers the same options and arguments and attaches the same
+// groups in the same order, then reads it instead of parsing again. Group
+// options travel with the command's own.
+
+// Serialize into `buf` (at most `cap` bytes). `len` always gets the full size,
+// so a call with cap 0 sizes the buffer. CLI_OUT_OF_BOUNDS if it didn't fit.
+cli_err cli_snapshot_write(cli_command* cli,
+                           void* buf,
+                           size_t cap,
+                           size_t* len);
+
+// Apply a snapshot to the registered targets as if cli_parse had run.
+// CLI_BAD_SNAPSHOT if the blob is damaged or was written by a command with
+// different registrations.
+cli_err cli_snapshot_read(cli_command* cli, const void* buf, size_t len);
+
+// Live values for long running services. A cli_live keeps the command's
+// option values as an immutable table that reader threads acquire without
+// locking, while a reload parses a new command line (from a control channel,
+// or a config file passed to cli_live_reload_line) and swaps in a fresh
+// table. A table is freed once no reader that could hold it remains.
+// Flags, ints, floats, strings, choices, sizes and durations are carried;
+// other option types read as NULL.
+typedef struct cli_live cli_live;
+typedef struct cli_values cli_values;
+
+// Call after registration, before any parse: the current targets become the
+// defaults every reload starts from, and the first published table. NULL
+// when out of memory.
+cli_live* cli_live_new(cli_command* cli);
+void cli_live_destroy(cli_live* live);
+
+// Restore the defaults, parse `argv` (with the program name, as for
+// cli_init) and publish the result. Reloads are serialized; a failed one
+// publishes nothing. Help comes back as CLI_PRINT_HELP_AND_EXIT.
+cli_err cli_live_reload(cli_live* live, int argc, char** argv);
+cli_err cli_live_reload_line(cli_live* live, char* line, size_t len);
+
+// Index of an option in every table, SIZE_MAX if there is none. Options of
+// attached groups have slots too.
+size_t cli_live_slot(cli_live* live, const char* name);
+
+// Pin the current table. Pass the returned token to cli_live_release when
+// done; the table must not be used after that.
+unsigned cli_live_acquire(cli_live* live, const cli_values** values);
+void cli_live_release(cli_live* live, unsigned token);
+
+// The value at `slot`, typed as its registration target (`const int*` for an
+// int, `const char*` for a string, ...), or NULL.
+const void* cli_values_get(const cli_values* values, size_t slot);
+bool cli_values_seen(const cli_values* values, size_t slot);
+
+// Embedded mode for parsing inside a long running process: cli_parse never
+// prints or exits. Help comes back as CLI_PRINT_HELP_AND_EXIT and the
+// completion command is an ordinary token. Pair with cli_command_try_new.
+void cli_set_embedded(cli_command* cli, bool embedded);
+
+// Where the last parse failed. `token` is a slice of the failing token as it
+// was given (argv, or what was fed) and `index` its argv index (the count of
+// tokens fed with cli_feed), -1 with `token` NULL when the failure was not
+// about one token. `option` names the option involved, if any.
+typedef struct cli_error {
+  cli_err code;
+  int index;
+  const char* token;
+  size_t token_len;
+  const char* option;
+} cli_error;
+
+cli_error cli_last_error(cli_command* cli);
+
+// Write `e` into `buf` like `--n: token parse failed for integer. (argv[2]
+// "--n=x")`. Same return and truncation as snprintf.
+size_t cli_format_error(const cli_error* e, char* buf, size_t cap);
+
+// "did you mean" support after cli_parse fails with CLI_NOT_FOUND or
+// CLI_AMBIGUOUS_OPT.
+
+// The unknown option name as a slice into argv (no dashes, no `=value`), or
+// NULL if the last parse did not fail on an option name.
+const char* cli_unknown_token(cli_command* cli, size_t* len);
+
+// Fill `out` with up to `n` registered names nearest the unknown token, closest
+// first, and return how many were found.
+size_t cli_suggest(cli_command* cli, const char** out, size_t n);
+
 #ifdef __cplusplus
 }
 #endif
@@ -13,7 +13,7 @@ int main(int argc, char** argv) {
   cli_command* c = cli_command_new();
 
   const char* desc = "Says hi and does a pointless calculation...\n";
-  const char* usage = "[-name] int float\n";
+  const char* usage = "[-name | -anon] int float\n";
 
   err = cli_init(c, desc, usage, argc, argv);
   fail_fast(err);
@@ -23,6 +23,14 @@ int main(int argc, char** argv) {
                            CLI_OPT_TOKEN_MAX_LEN);
   fail_fast(err);
 
+  bool anon = false;
+  err = cli_add_flag(c, "anon", "Stay anonymous. Not with -name.", &anon);
+  fail_fast(err);
+
+  const char* who[] = {"name", "anon"};
+  err = cli_add_exclusive(c, who, 2);
+  fail_fast(err);
+
   float x = 0.0;
   err = cli_add_float_argument(c, &x);
   fail_fast(err);
@@ -33,10 +41,23 @@ int main(int argc, char** argv) {
 
   if ((err = cli_parse(c)) != CLI_OK) {
     cli_print_err(err);
+
+    const char* near[3];
+    size_t n_near = cli_suggest(c, near, 3);
+    for (size_t i = 0; i < n_near; i++) {
+      fprintf(stderr, "did you mean -%s?\n", near[i]);
+    }
+
+    const char* violated = cli_violated_constraint(c);
+    if (violated != NULL) {
+      fprintf(stderr, "%s\n", violated);
+    }
     cli_print_help_and_exit(c, 1);
   }
 
-  if (strlen(name) == 0) {
+  if (anon) {
+    strcpy(name, "(anonymous)");
+  } else if (strlen(name) == 0) {
     strcat(name, "(whoever you are)");
   }
 
@@ -1,5 +1,12 @@
 #include <gtest/gtest.h>
 #include <stdbool.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include "cli.h"
 
@@ -495,4 +502,1770 @@ TEST(public, test_cli_parse_str_buf_too_small) {
   ASSERT_EQ(err, CLI_PARSE_FAILED_STR);
 
   cli_command_destroy(c);
-}
\ No newline at end of file
+}
+
+TEST(public, test_cli_print_completion_script_lists_sorted_opts) {
+  const char* argv[] = {"./bin/myapp"};
+  int argc = 1;
+
+  cli_command* c = cli_command_new();
+
+  cli_err err;
+  const char* desc = "A useful app";
+  const char* usage = "[OPTIONS]... [N]";
+
+  err = cli_init(c, desc, usage, argc, (char**)argv);
+  ASSERT_EQ(err, CLI_OK);
+
+  int x = 0;
+  err = cli_add_int_option(c, "x", "usage", &x, false);
+  ASSERT_EQ(err, CLI_OK);
+
+  bool verbose = false;
+  err = cli_add_flag(c, "verbose", "usage", &verbose);
+  ASSERT_EQ(err, CLI_OK);
+
+  testing::internal::CaptureStdout();
+  cli_print_completion_script(c, CLI_SHELL_BASH);
+  std::string out = testing::internal::GetCapturedStdout();
+
+  ASSERT_NE(out.find("-h --help --verbose -x"), std::string::npos);
+  ASSERT_NE(out.find("complete -o default -F _myapp myapp"),
+            std::string::npos);
+
+  cli_command_destroy(c);
+}
+
+TEST(public, test_cli_parse_complete_mode_exits_before_parse) {
+  // the required option is missing, but completion answers before checking
+  const char* argv[] = {"./myapp", "__complete", "--ve"};
+  int argc = 3;
+
+  cli_command* c = cli_command_new();
+
+  cli_err err;
+  const char* desc = "A useful app";
+  const char* usage = "[OPTIONS]... [N]";
+
+  err = cli_init(c, desc, usage, argc, (char**)argv);
+  ASSERT_EQ(err, CLI_OK);
+
+  int x = 0;
+  err = cli_add_int_option(c, "verbose", "usage", &x, true);
+  ASSERT_EQ(err, CLI_OK);
+
+  EXPECT_EXIT(cli_parse(c), testing::ExitedWithCode(0), "");
+
+  cli_command_destroy(c);
+}
+
+TEST(public, test_cli_parse_resolves_unambiguous_prefix) {
+  const char* argv[] = {"./myapp", "--verb", "--cou=3"};
+  int argc = 3;
+
+  cli_command* c = cli_command_new();
+
+  cli_err err;
+  const char* desc = "A useful app";
+  const char* usage = "[OPTIONS]... [N]";
+
+  err = cli_init(c, desc, usage, argc, (char**)argv);
+  ASSERT_EQ(err, CLI_OK);
+  cli_allow_abbrev(c, true);
+
+  bool verbose = false;
+  err = cli_add_flag(c, "verbose", "usage", &verbose);
+  ASSERT_EQ(err, CLI_OK);
+
+  bool version = false;
+  err = cli_add_flag(c, "version", "usage", &version);
+  ASSERT_EQ(err, CLI_OK);
+
+  int count = 0;
+  err = cli_add_int_option(c, "count", "usage", &count, false);
+  ASSERT_EQ(err, CLI_OK);
+
+  err = cli_parse(c);
+  ASSERT_EQ(err, CLI_OK);
+
+  ASSERT_TRUE(verbose);
+  ASSERT_FALSE(version);
+  ASSERT_EQ(count, 3);
+
+  cli_command_destroy(c);
+}
+
+TEST(public, test_cli_parse_rejects_ambiguous_prefix) {
+  const char* argv[] = {"./myapp", "--ver"};
+  int argc = 2;
+
+  cli_command* c = cli_command_new();
+
+  cli_err err;
+  const char* desc = "A useful app";
+  const char* usage = "[OPTIONS]... [N]";
+
+  err = cli_init(c, desc, usage, argc, (char**)argv);
+  ASSERT_EQ(err, CLI_OK);
+  cli_allow_abbrev(c, true);
+
+  bool verbose = false;
+  err = cli_add_flag(c, "verbose", "usage", &verbose);
+  ASSERT_EQ(err, CLI_OK);
+
+  bool version = false;
+  err = cli_add_flag(c, "version", "usage", &version);
+  ASSERT_EQ(err, CLI_OK);
+
+  err = cli_parse(c);
+  ASSERT_EQ(err, CLI_AMBIGUOUS_OPT);
+
+  cli_command_destroy(c);
+}
+
+TEST(public, test_cli_parse_help_abbrev_needs_no_value) {
+  const char* argv[] = {"./myapp"};
+  cli_command* c = cli_command_new();
+  ASSERT_EQ(cli_init(c, "d", "u", 1, (char**)argv), CLI_OK);
+  cli_allow_abbrev(c, true);
+
+  char he[] = "--he";
+  ASSERT_EQ(cli_parse_line(c, he, strlen(he)), CLI_PRINT_HELP_AND_EXIT);
+
+  // an inline value keeps help an ordinary flag, with or without abbrev
+  char help_value[] = "--help=x";
+  ASSERT_EQ(cli_parse_line(c, help_value, strlen(help_value)), CLI_OK);
+  char he_value[] = "--he=x";
+  ASSERT_EQ(cli_parse_line(c, he_value, strlen(he_value)), CLI_OK);
+  cli_allow_abbrev(c, false);
+  ASSERT_EQ(cli_parse_line(c, help_value, strlen(help_value)), CLI_OK);
+
+  cli_command_destroy(c);
+}
+
+TEST(public, test_cli_parse_prefix_not_found_without_abbrev) {
+  const char* argv[] = {"./myapp", "--verb"};
+  int argc = 2;
+
+  cli_command* c = cli_command_new();
+
+  cli_err err;
+  const char* desc = "A useful app";
+  const char* usage = "[OPTIONS]... [N]";
+
+  err = cli_init(c, desc, usage, argc, (char**)argv);
+  ASSERT_EQ(err, CLI_OK);
+
+  bool verbose = false;
+  err = cli_add_flag(c, "verbose", "usage", &verbose);
+  ASSERT_EQ(err, CLI_OK);
+
+  err = cli_parse(c);
+  ASSERT_EQ(err, CLI_NOT_FOUND);
+
+  cli_command_destroy(c);
+}
+
+TEST(public, test_cli_suggest_nearest_names_for_unknown_opt) {
+  const char* argv[] = {"./myapp", "--vrebose=1"};
+  int argc = 2;
+
+  cli_command* c = cli_command_new();
+
+  cli_err err;
+  const char* desc = "A useful app";
+  const char* usage = "[OPTIONS]... [N]";
+
+  err = cli_init(c, desc, usage, argc, (char**)argv);
+  ASSERT_EQ(err, CLI_OK);
+
+  int verbose = 0;
+  err = cli_add_int_option(c, "verbose", "usage", &verbose, false);
+  ASSERT_EQ(err, CLI_OK);
+
+  int verbosity = 0;
+  err = cli_add_int_option(c, "verbosity", "usage", &verbosity, false);
+  ASSERT_EQ(err, CLI_OK);
+
+  int output = 0;
+  err = cli_add_int_option(c, "output", "usage", &output, false);
+  ASSERT_EQ(err, CLI_OK);
+
+  err = cli_parse(c);
+  ASSERT_EQ(err, CLI_NOT_FOUND);
+
+  size_t len = 0;
+  const char* token = cli_unknown_token(c, &len);
+  ASSERT_EQ(std::string(token, len), "vrebose");
+
+  const char* near[4];
+  size_t n = cli_suggest(c, near, 4);
+  ASSERT_EQ(n, 1u);
+  ASSERT_STREQ(near[0], "verbose");
+
+  cli_command_destroy(c);
+}
+
+TEST(public, test_cli_parse_choice_option_sets_index) {
+  const char* argv[] = {"./myapp", "--compression=lz4"};
+  int argc = 2;
+
+  cli_command* c = cli_command_new();
+
+  cli_err err;
+  const char* desc = "A useful app";
+  const char* usage = "[OPTIONS]... [N]";
+
+  err = cli_init(c, desc, usage, argc, (char**)argv);
+  ASSERT_EQ(err, CLI_OK);
+
+  const char* choices[] = {"zstd", "lz4", "none"};
+  int compression = -1;
+  err = cli_add_choice_option(c, "compression", "usage", choices, 3,
+                              &compression, true);
+  ASSERT_EQ(err, CLI_OK);
+
+  err = cli_parse(c);
+  ASSERT_EQ(err, CLI_OK);
+  ASSERT_EQ(compression, 1);
+
+  cli_command_destroy(c);
+}
+
+TEST(public, test_cli_parse_choice_option_rejects_unknown_value) {
+  const char* argv[] = {"./myapp", "--compression", "gzip"};
+  int argc = 3;
+
+  cli_command* c = cli_command_new();
+
+  cli_err err;
+  const char* desc = "A useful app";
+  const char* usage = "[OPTIONS]... [N]";
+
+  err = cli_init(c, desc, usage, argc, (char**)argv);
+  ASSERT_EQ(err, CLI_OK);
+
+  const char* choices[] = {"zstd", "lz4", "none"};
+  int compression = -1;
+  const char* repeated[] = {"zstd", "zstd"};
+  err = cli_add_choice_option(c, "compression", "usage", repeated, 2,
+                              &compression, true);
+  ASSERT_EQ(err, CLI_BAD_CHOICES);
+  err = cli_add_choice_option(c, "compression", "usage", choices, 0,
+                              &compression, true);
+  ASSERT_EQ(err, CLI_BAD_CHOICES);
+  err = cli_add_choice_option(c, "compression", "usage", choices, 3,
+                              &compression, true);
+  ASSERT_EQ(err, CLI_OK);
+
+  err = cli_parse(c);
+  ASSERT_EQ(err, CLI_PARSE_FAILED_CHOICE);
+  ASSERT_EQ(compression, -1);
+
+  cli_command_destroy(c);
+}
+
+TEST(public, test_cli_print_help_lists_choices) {
+  const char* argv[] = {"./myapp", "--help"};
+  int argc = 2;
+
+  cli_command* c = cli_command_new();
+
+  cli_err err;
+  const char* desc = "A useful app";
+  const char* usage = "[OPTIONS]... [N]";
+
+  err = cli_init(c, desc, usage, argc, (char**)argv);
+  ASSERT_EQ(err, CLI_OK);
+
+  const char* choices[] = {"zstd", "lz4", "none"};
+  int compression = -1;
+  err = cli_add_choice_option(c, "compression", "usage", choices, 3,
+                              &compression, false);
+  ASSERT_EQ(err, CLI_OK);
+
+  EXPECT_EXIT(cli_parse(c), testing::ExitedWithCode(0), "zstd.lz4.none");
+
+  cli_command_destroy(c);
+}
+
+// decodes `host:port` straight into a struct
+struct endpoint {
+  char host[16];
+  int port;
+};
+
+static cli_err parse_endpoint(const char* token, size_t len, void* ctx) {
+  endpoint* ep = (endpoint*)ctx;
+  const char* colon = (const char*)memchr(token, ':', len);
+  if (colon == NULL || (size_t)(colon - token) >= sizeof(ep->host)) {
+    return CLI_PARSE_FAILED_CUSTOM;
+  }
+  memcpy(ep->host, token, colon - token);
+  ep->host[colon - token] = '\0';
+  ep->port = atoi(colon + 1);
+  return CLI_OK;
+}
+
+TEST(public, test_cli_parse_custom_option_and_argument) {
+  const char* argv[] = {"./myapp", "--bind=localhost:8080", "10.0.0.1:53"};
+  int argc = 3;
+
+  cli_command* c = cli_command_new();
+
+  cli_err err;
+  const char* desc = "A useful app";
+  const char* usage = "[OPTIONS]... [N]";
+
+  err = cli_init(c, desc, usage, argc, (char**)argv);
+  ASSERT_EQ(err, CLI_OK);
+
+  endpoint bind = {};
+  err = cli_add_custom_option(c, "bind", "usage", parse_endpoint, &bind, true);
+  ASSERT_EQ(err, CLI_OK);
+
+  endpoint upstream = {};
+  err = cli_add_custom_argument(c, parse_endpoint, &upstream);
+  ASSERT_EQ(err, CLI_OK);
+
+  err = cli_parse(c);
+  ASSERT_EQ(err, CLI_OK);
+
+  ASSERT_STREQ(bind.host, "localhost");
+  ASSERT_EQ(bind.port, 8080);
+  ASSERT_STREQ(upstream.host, "10.0.0.1");
+  ASSERT_EQ(upstream.port, 53);
+
+  cli_command_destroy(c);
+}
+
+TEST(public, test_cli_parse_custom_option_error_is_returned) {
+  const char* argv[] = {"./myapp", "--bind", "nope"};
+  int argc = 3;
+
+  cli_command* c = cli_command_new();
+
+  cli_err err;
+  const char* desc = "A useful app";
+  const char* usage = "[OPTIONS]... [N]";
+
+  err = cli_init(c, desc, usage, argc, (char**)argv);
+  ASSERT_EQ(err, CLI_OK);
+
+  endpoint bind = {};
+  err = cli_add_custom_option(c, "bind", "usage", parse_endpoint, &bind, true);
+  ASSERT_EQ(err, CLI_OK);
+
+  err = cli_parse(c);
+  ASSERT_EQ(err, CLI_PARSE_FAILED_CUSTOM);
+
+  cli_command_destroy(c);
+}
+
+TEST(public, test_cli_parse_size_and_duration_options) {
+  const char* argv[] = {"./myapp", "--mem=64MiB", "--disk", "1.5G",
+                        "--buf=10KB", "--timeout=1h30m", "--tick", "-1.5ms"};
+  int argc = 8;
+
+  cli_command* c = cli_command_new();
+
+  cli_err err;
+  const char* desc = "A useful app";
+  const char* usage = "[OPTIONS]... [N]";
+
+  err = cli_init(c, desc, usage, argc, (char**)argv);
+  ASSERT_EQ(err, CLI_OK);
+
+  uint64_t mem = 0, disk = 0, buf = 0;
+  err = cli_add_size_option(c, "mem", "usage", &mem, true);
+  ASSERT_EQ(err, CLI_OK);
+  err = cli_add_size_option(c, "disk", "usage", &disk, true);
+  ASSERT_EQ(err, CLI_OK);
+  err = cli_add_size_option(c, "buf", "usage", &buf, true);
+  ASSERT_EQ(err, CLI_OK);
+
+  int64_t timeout = 0, tick = 0;
+  err = cli_add_duration_option(c, "timeout", "usage", &timeout, true);
+  ASSERT_EQ(err, CLI_OK);
+  err = cli_add_duration_option(c, "tick", "usage", &tick, true);
+  ASSERT_EQ(err, CLI_OK);
+
+  err = cli_parse(c);
+  ASSERT_EQ(err, CLI_OK);
+
+  ASSERT_EQ(mem, 64ull << 20);
+  ASSERT_EQ(disk, 3ull << 29);
+  ASSERT_EQ(buf, 10000u);
+  ASSERT_EQ(timeout, 5400LL * 1000000000LL);
+  ASSERT_EQ(tick, -1500000LL);
+
+  cli_command_destroy(c);
+}
+
+TEST(public, test_cli_parse_size_option_detects_overflow) {
+  const char* argv[] = {"./myapp", "--mem=16EiB"};
+  int argc = 2;
+
+  cli_command* c = cli_command_new();
+
+  cli_err err;
+  const char* desc = "A useful app";
+  const char* usage = "[OPTIONS]... [N]";
+
+  err = cli_init(c, desc, usage, argc, (char**)argv);
+  ASSERT_EQ(err, CLI_OK);
+
+  uint64_t mem = 0;
+  err = cli_add_size_option(c, "mem", "usage", &mem, true);
+  ASSERT_EQ(err, CLI_OK);
+
+  err = cli_parse(c);
+  ASSERT_EQ(err, CLI_PARSE_FAILED_SIZE);
+
+  cli_command_destroy(c);
+}
+
+TEST(public, test_cli_parse_duration_option_requires_unit) {
+  const char* argv[] = {"./myapp", "--timeout=30"};
+  int argc = 2;
+
+  cli_command* c = cli_command_new();
+
+  cli_err err;
+  const char* desc = "A useful app";
+  const char* usage = "[OPTIONS]... [N]";
+
+  err = cli_init(c, desc, usage, argc, (char**)argv);
+  ASSERT_EQ(err, CLI_OK);
+
+  int64_t timeout = 0;
+  err = cli_add_duration_option(c, "timeout", "usage", &timeout, true);
+  ASSERT_EQ(err, CLI_OK);
+
+  err = cli_parse(c);
+  ASSERT_EQ(err, CLI_PARSE_FAILED_DURATION);
+
+  cli_command_destroy(c);
+}
+
+TEST(public, test_cli_parse_lazy_mode_converts_on_get) {
+  const char* argv[] = {"./myapp", "-n", "42", "--ratio=oops", "-v"};
+  int argc = 5;
+
+  cli_command* c = cli_command_new();
+
+  cli_err err;
+  const char* desc = "A useful app";
+  const char* usage = "[OPTIONS]... [N]";
+
+  err = cli_init(c, desc, usage, argc, (char**)argv);
+  ASSERT_EQ(err, CLI_OK);
+  cli_set_lazy(c, true);
+
+  int n = 0;
+  err = cli_add_int_option(c, "n", "usage", &n, true);
+  ASSERT_EQ(err, CLI_OK);
+
+  float ratio = 0.0;
+  err = cli_add_float_option(c, "ratio", "usage", &ratio, false);
+  ASSERT_EQ(err, CLI_OK);
+
+  bool v = false;
+  err = cli_add_flag(c, "v", "usage", &v);
+  ASSERT_EQ(err, CLI_OK);
+
+  // the bad float is only tokenized here
+  err = cli_parse(c);
+  ASSERT_EQ(err, CLI_OK);
+  ASSERT_EQ(n, 0);
+  ASSERT_FALSE(v);
+
+  int got = 0;
+  err = cli_get_int(c, "n", &got);
+  ASSERT_EQ(err, CLI_OK);
+  ASSERT_EQ(got, 42);
+  ASSERT_EQ(n, 42);
+
+  // cached, a flag must not toggle back on a second read
+  bool got_v = false;
+  ASSERT_EQ(cli_get_flag(c, "v", &got_v), CLI_OK);
+  ASSERT_EQ(cli_get_flag(c, "v", &got_v), CLI_OK);
+  ASSERT_TRUE(got_v);
+
+  float got_ratio = 0.0;
+  err = cli_get_float(c, "ratio", &got_ratio);
+  ASSERT_EQ(err, CLI_PARSE_FAILED_FLOAT);
+
+  err = cli_get_int(c, "ratio", &got);
+  ASSERT_EQ(err, CLI_TYPE_MISMATCH);
+
+  err = cli_get_int(c, "missing", &got);
+  ASSERT_EQ(err, CLI_NOT_FOUND);
+
+  cli_command_destroy(c);
+}
+
+TEST(public, test_cli_feed_tokens_incrementally) {
+  // tokens arrive as slices of one frame, none of them NUL terminated
+  const char frame[] = "-n42--name=bob--17";
+  const char* argv[] = {"./myapp"};
+  int argc = 1;
+
+  cli_command* c = cli_command_new();
+
+  cli_err err;
+  const char* desc = "A useful app";
+  const char* usage = "[OPTIONS]... [N]";
+
+  err = cli_init(c, desc, usage, argc, (char**)argv);
+  ASSERT_EQ(err, CLI_OK);
+
+  int n = 0;
+  err = cli_add_int_option(c, "n", "usage", &n, true);
+  ASSERT_EQ(err, CLI_OK);
+
+  char name[8] = "";
+  err = cli_add_str_option(c, "name", "usage", name, false, 8);
+  ASSERT_EQ(err, CLI_OK);
+
+  int pos = 0;
+  err = cli_add_int_argument(c, &pos);
+  ASSERT_EQ(err, CLI_OK);
+
+  cli_begin(c);
+  ASSERT_EQ(cli_feed(c, frame, 2), CLI_OK);       // -n
+  ASSERT_EQ(cli_feed(c, frame + 2, 2), CLI_OK);   // 42
+  ASSERT_EQ(n, 42);
+  ASSERT_EQ(cli_feed(c, frame + 4, 10), CLI_OK);  // --name=bob
+  ASSERT_STREQ(name, "bob");
+  ASSERT_EQ(cli_feed(c, frame + 14, 2), CLI_OK);  // --
+  ASSERT_EQ(cli_feed(c, frame + 16, 2), CLI_OK);  // 17
+  ASSERT_EQ(cli_finish(c), CLI_OK);
+  ASSERT_EQ(pos, 17);
+
+  // and again with a dangling option
+  cli_begin(c);
+  ASSERT_EQ(cli_feed(c, frame, 2), CLI_OK);
+  ASSERT_EQ(cli_finish(c), CLI_OUT_OF_BOUNDS);
+
+  cli_command_destroy(c);
+}
+
+TEST(public, test_cli_parse_line_splits_with_shell_quoting) {
+  const char* argv[] = {"./myapp"};
+  int argc = 1;
+
+  cli_command* c = cli_command_new();
+
+  cli_err err;
+  const char* desc = "A useful app";
+  const char* usage = "[OPTIONS]... [N]";
+
+  err = cli_init(c, desc, usage, argc, (char**)argv);
+  ASSERT_EQ(err, CLI_OK);
+
+  char name[32] = "";
+  err = cli_add_str_option(c, "name", "usage", name, true, 32);
+  ASSERT_EQ(err, CLI_OK);
+
+  char title[32] = "";
+  err = cli_add_str_option(c, "title", "usage", title, false, 32);
+  ASSERT_EQ(err, CLI_OK);
+
+  char file[32] = "";
+  err = cli_add_str_argument(c, file, 32);
+  ASSERT_EQ(err, CLI_OK);
+
+  char empty[4] = "x";
+  err = cli_add_str_argument(c, empty, 4);
+  ASSERT_EQ(err, CLI_OK);
+
+  char line[] = "--name 'Bob \"B\" Smith'  --title=\"a \\\"quoted\\\" $x\" "
+                "my\\ file.txt ''";
+  err = cli_parse_line(c, line, strlen(line));
+  ASSERT_EQ(err, CLI_OK);
+
+  ASSERT_STREQ(name, "Bob \"B\" Smith");
+  ASSERT_STREQ(title, "a \"quoted\" $x");
+  ASSERT_STREQ(file, "my file.txt");
+  ASSERT_STREQ(empty, "");
+
+  char bad[] = "--name 'unterminated";
+  err = cli_parse_line(c, bad, strlen(bad));
+  ASSERT_EQ(err, CLI_BAD_QUOTING);
+
+  cli_command_destroy(c);
+}
+
+TEST(public, test_cli_parse_line_starts_each_line_from_defaults) {
+  const char* argv[] = {"./myapp"};
+  cli_command* c = cli_command_new();
+  ASSERT_EQ(cli_init(c, "d", "u", 1, (char**)argv), CLI_OK);
+
+  bool verbose = false;
+  ASSERT_EQ(cli_add_flag(c, "v", "usage", &verbose), CLI_OK);
+  int n = 10;
+  ASSERT_EQ(cli_add_int_option(c, "n", "usage", &n, false), CLI_OK);
+  char tag[8] = "none";
+  ASSERT_EQ(cli_add_str_option(c, "tag", "usage", tag, false, 8), CLI_OK);
+
+  char first[] = "-v -n 1 --tag=a";
+  ASSERT_EQ(cli_parse_line(c, first, strlen(first)), CLI_OK);
+  ASSERT_TRUE(verbose);
+  ASSERT_EQ(n, 1);
+  ASSERT_STREQ(tag, "a");
+
+  char second[] = "-v -n 2";
+  ASSERT_EQ(cli_parse_line(c, second, strlen(second)), CLI_OK);
+  ASSERT_TRUE(verbose);
+  ASSERT_EQ(n, 2);
+  ASSERT_STREQ(tag, "none");
+
+  char third[] = "--tag=b";
+  ASSERT_EQ(cli_parse_line(c, third, strlen(third)), CLI_OK);
+  ASSERT_FALSE(verbose);
+  ASSERT_EQ(n, 10);
+  ASSERT_STREQ(tag, "b");
+
+  cli_command_destroy(c);
+}
+
+// registers the same schema for the parent and the worker side
+struct snapshot_targets {
+  int n = 0;
+  float f = 0.0;
+  char s[16] = "";
+  bool v = false;
+  int mode = -1;
+  uint64_t mem = 0;
+  endpoint ep = {};
+  char file[16] = "";
+};
+
+static void register_snapshot_targets(cli_command* c, snapshot_targets* t) {
+  static const char* modes[] = {"fast", "slow"};
+  ASSERT_EQ(cli_add_int_option(c, "n", "usage", &t->n, false), CLI_OK);
+  ASSERT_EQ(cli_add_float_option(c, "f", "usage", &t->f, false), CLI_OK);
+  ASSERT_EQ(cli_add_str_option(c, "s", "usage", t->s, false, 16), CLI_OK);
+  ASSERT_EQ(cli_add_flag(c, "v", "usage", &t->v), CLI_OK);
+  ASSERT_EQ(cli_add_choice_option(c, "mode", "usage", modes, 2, &t->mode,
+                                  false),
+            CLI_OK);
+  ASSERT_EQ(cli_add_size_option(c, "mem", "usage", &t->mem, false), CLI_OK);
+  ASSERT_EQ(cli_add_custom_option(c, "ep", "usage", parse_endpoint, &t->ep,
+                                  false),
+            CLI_OK);
+  ASSERT_EQ(cli_add_str_argument(c, t->file, 16), CLI_OK);
+}
+
+TEST(public, test_cli_snapshot_round_trip) {
+  const char* argv[] = {"./myapp", "-n",       "7",          "--s=hi",
+                        "-v",      "--mode=slow", "--mem=2K", "--ep=db:5432",
+                        "in.txt"};
+  int argc = 9;
+
+  cli_command* parent = cli_command_new();
+  ASSERT_EQ(cli_init(parent, "d", "u", argc, (char**)argv), CLI_OK);
+  snapshot_targets pt;
+  register_snapshot_targets(parent, &pt);
+  ASSERT_EQ(cli_parse(parent), CLI_OK);
+
+  size_t len = 0;
+  ASSERT_EQ(cli_snapshot_write(parent, NULL, 0, &len), CLI_OUT_OF_BOUNDS);
+  std::vector<char> blob(len);
+  ASSERT_EQ(cli_snapshot_write(parent, blob.data(), blob.size(), &len),
+            CLI_OK);
+  cli_command_destroy(parent);
+
+  const char* worker_argv[] = {"./worker"};
+  cli_command* worker = cli_command_new();
+  ASSERT_EQ(cli_init(worker, "d", "u", 1, (char**)worker_argv), CLI_OK);
+  snapshot_targets wt;
+  register_snapshot_targets(worker, &wt);
+  ASSERT_EQ(cli_snapshot_read(worker, blob.data(), len), CLI_OK);
+
+  ASSERT_EQ(wt.n, 7);
+  ASSERT_FLOAT_EQ(wt.f, 0.0);
+  ASSERT_STREQ(wt.s, "hi");
+  ASSERT_TRUE(wt.v);
+  ASSERT_EQ(wt.mode, 1);
+  ASSERT_EQ(wt.mem, 2048u);
+  ASSERT_STREQ(wt.ep.host, "db");
+  ASSERT_EQ(wt.ep.port, 5432);
+  ASSERT_STREQ(wt.file, "in.txt");
+
+  cli_command_destroy(worker);
+}
+
+TEST(public, test_cli_snapshot_read_rejects_other_schema) {
+  const char* argv[] = {"./myapp", "-n", "7"};
+  int argc = 3;
+
+  cli_command* parent = cli_command_new();
+  ASSERT_EQ(cli_init(parent, "d", "u", argc, (char**)argv), CLI_OK);
+  int n = 0;
+  ASSERT_EQ(cli_add_int_option(parent, "n", "usage", &n, false), CLI_OK);
+  ASSERT_EQ(cli_parse(parent), CLI_OK);
+
+  char blob[256];
+  size_t len = 0;
+  ASSERT_EQ(cli_snapshot_write(parent, blob, sizeof(blob), &len), CLI_OK);
+  cli_command_destroy(parent);
+
+  cli_command* worker = cli_command_new();
+  ASSERT_EQ(cli_init(worker, "d", "u", argc, (char**)argv), CLI_OK);
+  float f = 0.0;
+  ASSERT_EQ(cli_add_float_option(worker, "n", "usage", &f, false), CLI_OK);
+  ASSERT_EQ(cli_snapshot_read(worker, blob, len), CLI_BAD_SNAPSHOT);
+
+  cli_command_destroy(worker);
+}
+
+TEST(public, test_cli_group_shared_between_commands) {
+  cli_command* logging = cli_group_new();
+  int level = 0;
+  ASSERT_EQ(cli_add_int_option(logging, "log-level", "usage", &level, false),
+            CLI_OK);
+  char trace[16] = "";
+  ASSERT_EQ(cli_add_str_option(logging, "trace", "usage", trace, true, 16),
+            CLI_OK);
+
+  const char* argv_a[] = {"./tool", "-n", "1", "--log-level=3", "--trace=x"};
+  cli_command* a = cli_command_new();
+  ASSERT_EQ(cli_init(a, "d", "u", 5, (char**)argv_a), CLI_OK);
+  int n = 0;
+  ASSERT_EQ(cli_add_int_option(a, "n", "usage", &n, true), CLI_OK);
+  ASSERT_EQ(cli_add_group(a, logging), CLI_OK);
+
+  const char* argv_b[] = {"./tool", "--log-level=5"};
+  cli_command* b = cli_command_new();
+  ASSERT_EQ(cli_init(b, "d", "u", 2, (char**)argv_b), CLI_OK);
+  ASSERT_EQ(cli_add_group(b, logging), CLI_OK);
+  ASSERT_EQ(cli_add_group(b, logging), CLI_BAD_GROUP);
+  ASSERT_EQ(cli_add_group(b, b), CLI_BAD_GROUP);
+
+  // commands hold their own references now
+  cli_command_destroy(logging);
+
+  ASSERT_EQ(cli_parse(a), CLI_OK);
+  ASSERT_EQ(n, 1);
+  ASSERT_EQ(level, 3);
+  ASSERT_STREQ(trace, "x");
+
+  // required group options are enforced on every command
+  ASSERT_EQ(cli_parse(b), CLI_UNSEEN_REQ_OPTS);
+  ASSERT_EQ(level, 5);
+
+  int got = 0;
+  ASSERT_EQ(cli_get_int(b, "log-level", &got), CLI_OK);
+  ASSERT_EQ(got, 5);
+
+  cli_command_destroy(a);
+  cli_command_destroy(b);
+}
+
+TEST(public, test_cli_snapshot_carries_group_options) {
+  const char* argv[] = {"./myapp", "-n", "2", "--threads=8"};
+  int argc = 4;
+
+  int pn = 0;
+  int pthreads = 0;
+  cli_command* pool = cli_group_new();
+  ASSERT_EQ(cli_add_int_option(pool, "threads", "usage", &pthreads, false),
+            CLI_OK);
+  cli_command* parent = cli_command_new();
+  ASSERT_EQ(cli_init(parent, "d", "u", argc, (char**)argv), CLI_OK);
+  ASSERT_EQ(cli_add_int_option(parent, "n", "usage", &pn, false), CLI_OK);
+  ASSERT_EQ(cli_add_group(parent, pool), CLI_OK);
+  cli_command_destroy(pool);
+  ASSERT_EQ(cli_parse(parent), CLI_OK);
+
+  char blob[256];
+  size_t len = 0;
+  ASSERT_EQ(cli_snapshot_write(parent, blob, sizeof(blob), &len), CLI_OK);
+  cli_command_destroy(parent);
+
+  int wn = 0;
+  int wthreads = 0;
+  const char* worker_argv[] = {"./worker"};
+  pool = cli_group_new();
+  ASSERT_EQ(cli_add_int_option(pool, "threads", "usage", &wthreads, false),
+            CLI_OK);
+  cli_command* worker = cli_command_new();
+  ASSERT_EQ(cli_init(worker, "d", "u", 1, (char**)worker_argv), CLI_OK);
+  ASSERT_EQ(cli_add_int_option(worker, "n", "usage", &wn, false), CLI_OK);
+
+  // without the group the registrations differ
+  ASSERT_EQ(cli_snapshot_read(worker, blob, len), CLI_BAD_SNAPSHOT);
+
+  ASSERT_EQ(cli_add_group(worker, pool), CLI_OK);
+  cli_command_destroy(pool);
+  ASSERT_EQ(cli_snapshot_read(worker, blob, len), CLI_OK);
+  ASSERT_EQ(wn, 2);
+  ASSERT_EQ(wthreads, 8);
+
+  int got = 0;
+  ASSERT_EQ(cli_get_int(worker, "threads", &got), CLI_OK);
+  ASSERT_EQ(got, 8);
+
+  cli_command_destroy(worker);
+}
+
+TEST(public, test_cli_parse_classifies_long_tokens) {
+  // names and values straddle the 16 byte blocks of the pre-pass
+  const char* argv[] = {"./myapp",
+                        "--a-rather-long-option-name=key=value",
+                        "-n",
+                        "--17",
+                        "--",
+                        "-5"};
+  int argc = 6;
+
+  cli_command* c = cli_command_new();
+
+  cli_err err;
+  const char* desc = "A useful app";
+  const char* usage = "[OPTIONS]... [N]";
+
+  err = cli_init(c, desc, usage, argc, (char**)argv);
+  ASSERT_EQ(err, CLI_OK);
+
+  char kv[32] = "";
+  err = cli_add_str_option(c, "a-rather-long-option-name", "usage", kv, true,
+                           32);
+  ASSERT_EQ(err, CLI_OK);
+
+  char n[8] = "";
+  err = cli_add_str_option(c, "n", "usage", n, true, 8);
+  ASSERT_EQ(err, CLI_OK);
+
+  int pos = 0;
+  err = cli_add_int_argument(c, &pos);
+  ASSERT_EQ(err, CLI_OK);
+
+  err = cli_parse(c);
+  ASSERT_EQ(err, CLI_OK);
+  ASSERT_STREQ(kv, "key=value");
+  ASSERT_STREQ(n, "--17");
+  ASSERT_EQ(pos, -5);
+
+  cli_command_destroy(c);
+}
+
+TEST(public, test_cli_parse_more_tokens_than_args) {
+  std::vector<std::string> tokens = {"./myapp", "--"};
+  for (int i = 0; i < CLI_MAX_ARGS + 8; i++) {
+    tokens.push_back(std::to_string(i));
+  }
+  std::vector<char*> argv;
+  for (auto& t : tokens) {
+    argv.push_back(t.data());
+  }
+
+  cli_command* c = cli_command_new();
+  ASSERT_EQ(cli_init(c, "d", "u", (int)argv.size(), argv.data()), CLI_OK);
+
+  int first = -1;
+  ASSERT_EQ(cli_add_int_argument(c, &first), CLI_OK);
+
+  ASSERT_EQ(cli_parse(c), CLI_ARG_COUNT);
+  ASSERT_EQ(first, 0);
+
+  cli_command_destroy(c);
+}
+
+TEST(public, test_cli_parse_checks_constraints) {
+  const char* argv[] = {"./myapp", "--input=a.txt", "--stdin", "--tls-key=k"};
+  int argc = 4;
+
+  cli_command* c = cli_command_new();
+  ASSERT_EQ(cli_init(c, "d", "u", argc, (char**)argv), CLI_OK);
+
+  char input[16] = "";
+  ASSERT_EQ(cli_add_str_option(c, "input", "usage", input, false, 16), CLI_OK);
+  bool use_stdin = false;
+  ASSERT_EQ(cli_add_flag(c, "stdin", "usage", &use_stdin), CLI_OK);
+  char key[16] = "";
+  ASSERT_EQ(cli_add_str_option(c, "tls-key", "usage", key, false, 16), CLI_OK);
+  char cert[16] = "";
+  ASSERT_EQ(cli_add_str_option(c, "tls-cert", "usage", cert, false, 16),
+            CLI_OK);
+
+  const char* sources[] = {"input", "stdin"};
+  const char* tls_needs[] = {"tls-cert"};
+  const char* bogus[] = {"input", "nope"};
+  ASSERT_EQ(cli_add_exclusive(c, sources, 2), CLI_OK);
+  ASSERT_EQ(cli_add_requires(c, "tls-key", tls_needs, 1), CLI_OK);
+  ASSERT_EQ(cli_add_one_of(c, sources, 2), CLI_OK);
+  ASSERT_EQ(cli_add_exclusive(c, bogus, 2), CLI_NOT_FOUND);
+  ASSERT_EQ(cli_add_one_of(c, sources, 0), CLI_NAME_REQUIRED);
+
+  ASSERT_EQ(cli_parse(c), CLI_EXCLUSIVE_OPTS);
+  ASSERT_STREQ(cli_violated_constraint(c),
+               "--input, --stdin are mutually exclusive");
+
+  // the same command fed other lines
+  const char* only_key[] = {"--stdin", "--tls-key=k"};
+  cli_begin(c);
+  for (const char* t : only_key) {
+    ASSERT_EQ(cli_feed(c, t, strlen(t)), CLI_OK);
+  }
+  ASSERT_EQ(cli_finish(c), CLI_UNMET_REQUIRES);
+  ASSERT_STREQ(cli_violated_constraint(c), "--tls-key requires --tls-cert");
+
+  cli_begin(c);
+  ASSERT_EQ(cli_finish(c), CLI_UNSEEN_ONE_OF);
+  ASSERT_STREQ(cli_violated_constraint(c),
+               "one of --input, --stdin is required");
+
+  const char* good[] = {"--tls-cert=c", "--input=b", "--tls-key=k"};
+  cli_begin(c);
+  for (const char* t : good) {
+    ASSERT_EQ(cli_feed(c, t, strlen(t)), CLI_OK);
+  }
+  ASSERT_EQ(cli_finish(c), CLI_OK);
+  ASSERT_EQ(cli_violated_constraint(c), nullptr);
+
+  cli_command_destroy(c);
+}
+
+struct action_counter {
+  std::atomic<int> calls{0};
+  cli_err result = CLI_OK;
+};
+
+static cli_err count_action(void* ctx) {
+  action_counter* counter = (action_counter*)ctx;
+  counter->calls++;
+  return counter->result;
+}
+
+TEST(public, test_cli_run_actions_for_seen_options) {
+  const char* argv[] = {"./myapp", "--dict=words", "--cache", "--keys=k"};
+  int argc = 4;
+
+  cli_command* c = cli_command_new();
+  ASSERT_EQ(cli_init(c, "d", "u", argc, (char**)argv), CLI_OK);
+
+  char dict[16] = "";
+  ASSERT_EQ(cli_add_str_option(c, "dict", "usage", dict, false, 16), CLI_OK);
+  bool cache = false;
+  ASSERT_EQ(cli_add_flag(c, "cache", "usage", &cache), CLI_OK);
+  char keys[16] = "";
+  ASSERT_EQ(cli_add_str_option(c, "keys", "usage", keys, false, 16), CLI_OK);
+  char tls[16] = "";
+  ASSERT_EQ(cli_add_str_option(c, "tls", "usage", tls, false, 16), CLI_OK);
+
+  action_counter counters[4];
+  const char* names[] = {"dict", "cache", "keys", "tls"};
+  for (int i = 0; i < 4; i++) {
+    ASSERT_EQ(cli_add_action(c, names[i], count_action, &counters[i]),
+              CLI_OK);
+  }
+  ASSERT_EQ(cli_add_action(c, "nope", count_action, NULL), CLI_NOT_FOUND);
+
+  // nothing runs inline during the parse
+  ASSERT_EQ(cli_parse(c), CLI_OK);
+  for (auto& counter : counters) {
+    ASSERT_EQ(counter.calls, 0);
+  }
+
+  ASSERT_EQ(cli_run_actions(c, 4), CLI_OK);
+  ASSERT_EQ(counters[0].calls, 1);
+  ASSERT_EQ(counters[1].calls, 1);
+  ASSERT_EQ(counters[2].calls, 1);
+  ASSERT_EQ(counters[3].calls, 0);  // --tls was not given
+
+  // every action still runs, the first failure is reported
+  counters[2].result = CLI_PARSE_FAILED_CUSTOM;
+  ASSERT_EQ(cli_run_actions(c, 1), CLI_PARSE_FAILED_CUSTOM);
+  ASSERT_EQ(counters[0].calls, 2);
+  ASSERT_EQ(counters[1].calls, 2);
+
+  cli_command_destroy(c);
+}
+
+TEST(public, test_cli_parse_utf8_strings) {
+  // a long ascii run ahead of the multi-byte tail exercises the fast path
+  const char* argv[] = {"./myapp", "--name=plain ascii prefix caf\xc3\xa9",
+                        "\xe2\x82\xac\xf0\x9f\x98\x80"};
+  int argc = 3;
+
+  cli_command* c = cli_command_new();
+  ASSERT_EQ(cli_init(c, "d", "u", argc, (char**)argv), CLI_OK);
+
+  char name[32] = "";
+  ASSERT_EQ(cli_add_str_option(c, "name", "usage", name, true, 32), CLI_OK);
+  cli_require_utf8(c, true);
+
+  // registered after the switch, still covered
+  char pos[16] = "";
+  ASSERT_EQ(cli_add_str_argument(c, pos, 16), CLI_OK);
+
+  ASSERT_EQ(cli_parse(c), CLI_OK);
+  ASSERT_STREQ(name, "plain ascii prefix caf\xc3\xa9");
+  ASSERT_STREQ(pos, "\xe2\x82\xac\xf0\x9f\x98\x80");
+
+  // overlong, surrogate, truncated and out of range sequences
+  const char* bad[] = {"\xc0\xaf", "\xed\xa0\x80", "abcdefghijklmnop\xe2\x82",
+                       "\xf4\x90\x80\x80"};
+  for (const char* b : bad) {
+    std::string opt = std::string("--name=") + b;
+    cli_begin(c);
+    ASSERT_EQ(cli_feed(c, opt.data(), opt.size()), CLI_PARSE_FAILED_UTF8);
+  }
+  cli_begin(c);
+  ASSERT_EQ(cli_feed(c, "--name=x", 8), CLI_OK);
+  ASSERT_EQ(cli_feed(c, "\xff", 1), CLI_PARSE_FAILED_UTF8);
+
+  // off again, bytes pass through untouched
+  cli_require_utf8(c, false);
+  cli_begin(c);
+  ASSERT_EQ(cli_feed(c, "--name=\xc0\xaf", 9), CLI_OK);
+
+  cli_command_destroy(c);
+}
+
+TEST(public, test_cli_parse_utf8_across_blocks) {
+  const char* argv[] = {"./myapp"};
+  cli_command* c = cli_command_new();
+  ASSERT_EQ(cli_init(c, "d", "u", 1, (char**)argv), CLI_OK);
+  char name[128] = "";
+  ASSERT_EQ(cli_add_str_option(c, "name", "usage", name, false, 128), CLI_OK);
+  cli_require_utf8(c, true);
+
+  // every sequence at every offset around the 16 byte blocks
+  struct sample {
+    const char* bytes;
+    bool ok;
+  };
+  const sample samples[] = {
+      {"\xc3\xa9", true},          {"\xe2\x82\xac", true},
+      {"\xf0\x9f\x98\x80", true},  {"\xed\x9f\xbf", true},
+      {"\xf4\x8f\xbf\xbf", true},  {"\xc1\xbf", false},
+      {"\xe0\x9f\xbf", false},     {"\xed\xa0\x80", false},
+      {"\xf0\x8f\xbf\xbf", false}, {"\xf4\x90\x80\x80", false},
+      {"\xf5\x80\x80\x80", false}, {"\x80", false},
+      {"\xe2\x82", false},         {"\xc3\xc3\xa9", false},
+  };
+  for (const sample& smp : samples) {
+    for (size_t pad = 0; pad < 34; pad++) {
+      for (bool tail : {false, true}) {
+        std::string opt = "--name=" + std::string(pad, 'a') + smp.bytes;
+        if (tail) {
+          opt += std::string(20, 'z');
+        }
+        cli_begin(c);
+        ASSERT_EQ(cli_feed(c, opt.data(), opt.size()),
+                  smp.ok ? CLI_OK : CLI_PARSE_FAILED_UTF8)
+            << smp.bytes << " after " << pad << " bytes";
+      }
+    }
+  }
+
+  cli_command_destroy(c);
+}
+
+TEST(public, test_cli_parse_path_checks) {
+  char dir_tmpl[] = "/tmp/cli_paths_XXXXXX";
+  ASSERT_NE(mkdtemp(dir_tmpl), nullptr);
+  std::string dir = dir_tmpl;
+  std::string file = dir + "/a.txt";
+  FILE* f = fopen(file.c_str(), "w");
+  ASSERT_NE(f, nullptr);
+  fclose(f);
+  std::string missing = dir + "/missing";
+
+  std::vector<std::string> tokens = {"./myapp", "--out=" + dir, file};
+  for (int i = 0; i < 200; i++) {
+    tokens.push_back(file);  // enough paths to spread over threads
+  }
+  tokens.push_back(missing);
+  tokens.push_back(dir);
+  std::vector<char*> argv;
+  for (auto& t : tokens) {
+    argv.push_back(t.data());
+  }
+
+  cli_command* c = cli_command_new();
+  ASSERT_EQ(cli_init(c, "d", "u", (int)argv.size(), argv.data()), CLI_OK);
+
+  const char* out = nullptr;
+  ASSERT_EQ(cli_add_path_option(c, "out", "usage", &out, CLI_PATH_DIR, true),
+            CLI_OK);
+  const char* first = nullptr;
+  ASSERT_EQ(cli_add_path_argument(c, &first, CLI_PATH_READABLE), CLI_OK);
+  const char** rest = nullptr;
+  size_t n_rest = 0;
+  ASSERT_EQ(cli_add_path_arguments(c, &rest, &n_rest, CLI_PATH_FILE), CLI_OK);
+
+  int extra = 0;
+  ASSERT_EQ(cli_add_int_argument(c, &extra), CLI_ARG_COUNT);
+
+  // both bad paths are reported, in order
+  ASSERT_EQ(cli_parse(c), CLI_BAD_PATHS);
+  ASSERT_STREQ(out, dir.c_str());
+  ASSERT_STREQ(first, file.c_str());
+  ASSERT_EQ(n_rest, 202u);
+  ASSERT_STREQ(rest[0], file.c_str());
+  ASSERT_STREQ(rest[201], dir.c_str());
+
+  ASSERT_EQ(cli_bad_path_count(c), 2u);
+  int why = 0;
+  ASSERT_STREQ(cli_bad_path(c, 0, &why), missing.c_str());
+  ASSERT_EQ(why, ENOENT);
+  ASSERT_STREQ(cli_bad_path(c, 1, &why), dir.c_str());
+  ASSERT_EQ(why, EISDIR);
+  ASSERT_EQ(cli_bad_path(c, 2, &why), nullptr);
+
+  // the variadic argument may be empty
+  std::string opt = "--out=" + dir;
+  cli_begin(c);
+  ASSERT_EQ(cli_feed(c, opt.data(), opt.size()), CLI_OK);
+  ASSERT_EQ(cli_feed(c, file.data(), file.size()), CLI_OK);
+  ASSERT_EQ(cli_finish(c), CLI_OK);
+  ASSERT_EQ(n_rest, 0u);
+  ASSERT_EQ(cli_bad_path_count(c), 0u);
+
+  // paths survive a snapshot round trip
+  std::string second = file + "2";
+  cli_begin(c);
+  ASSERT_EQ(cli_feed(c, opt.data(), opt.size()), CLI_OK);
+  ASSERT_EQ(cli_feed(c, file.data(), file.size()), CLI_OK);
+  ASSERT_EQ(cli_feed(c, second.data(), second.size()), CLI_OK);
+  ASSERT_EQ(cli_finish(c), CLI_BAD_PATHS);
+  char blob[512];
+  size_t len = 0;
+  ASSERT_EQ(cli_snapshot_write(c, blob, sizeof(blob), &len), CLI_OK);
+  ASSERT_EQ(cli_snapshot_read(c, blob, len), CLI_OK);
+  ASSERT_STREQ(out, dir.c_str());
+  ASSERT_EQ(n_rest, 1u);
+  ASSERT_STREQ(rest[0], second.c_str());
+
+  cli_command_destroy(c);
+  remove(file.c_str());
+  rmdir(dir.c_str());
+}
+
+TEST(public, test_cli_parse_expands_globs) {
+  char dir_tmpl[] = "/tmp/cli_globs_XXXXXX";
+  ASSERT_NE(mkdtemp(dir_tmpl), nullptr);
+  std::string dir = dir_tmpl;
+  const char* names[] = {"b.parquet", "a.parquet", "c.txt"};
+  for (const char* name : names) {
+    FILE* f = fopen((dir + "/" + name).c_str(), "w");
+    ASSERT_NE(f, nullptr);
+    fclose(f);
+  }
+
+  std::string pattern = dir + "/*.parquet";
+  std::string none = dir + "/*.none";
+  const char* argv[] = {"./myapp", "--n=3", "x*", pattern.c_str(),
+                        none.c_str()};
+  int argc = 5;
+
+  cli_command* c = cli_command_new();
+  ASSERT_EQ(cli_init(c, "d", "u", argc, (char**)argv), CLI_OK);
+  cli_expand_globs(c, true);
+
+  int n = 0;
+  ASSERT_EQ(cli_add_int_option(c, "n", "usage", &n, true), CLI_OK);
+  char first[32] = "";
+  ASSERT_EQ(cli_add_str_argument(c, first, 32), CLI_OK);
+  const char** rest = nullptr;
+  size_t n_rest = 0;
+  ASSERT_EQ(cli_add_path_arguments(c, &rest, &n_rest, CLI_PATH_ANY), CLI_OK);
+
+  // matches come back sorted, a pattern without any is kept as is
+  ASSERT_EQ(cli_parse(c), CLI_OK);
+  ASSERT_STREQ(first, "x*");
+  ASSERT_EQ(n_rest, 3u);
+  ASSERT_EQ(rest[0], dir + "/a.parquet");
+  ASSERT_EQ(rest[1], dir + "/b.parquet");
+  ASSERT_EQ(rest[2], none);
+
+  // quoted words stay literal
+  std::string line = "--n=1 one '" + pattern + "' " + dir + "/*.t?t";
+  ASSERT_EQ(cli_parse_line(c, line.data(), line.size()), CLI_OK);
+  ASSERT_EQ(n_rest, 2u);
+  ASSERT_EQ(rest[0], pattern);
+  ASSERT_EQ(rest[1], dir + "/c.txt");
+
+  cli_command_destroy(c);
+  for (const char* name : names) {
+    remove((dir + "/" + name).c_str());
+  }
+  rmdir(dir.c_str());
+}
+
+TEST(public, test_cli_parse_expands_globs_across_directories) {
+  char dir_tmpl[] = "/tmp/cli_globs_XXXXXX";
+  ASSERT_NE(mkdtemp(dir_tmpl), nullptr);
+  std::string dir = dir_tmpl;
+  const char* subdirs[] = {"p2", "p1", "p3"};
+  const char* files[] = {"p1/part-1.parquet", "p1/part-0.parquet",
+                         "p1/.part-2.parquet", "p2/part-0.parquet",
+                         "p3/part-0.parquet", "px.parquet"};
+  for (const char* sub : subdirs) {
+    ASSERT_EQ(mkdir((dir + "/" + sub).c_str(), 0700), 0);
+  }
+  for (const char* name : files) {
+    FILE* f = fopen((dir + "/" + name).c_str(), "w");
+    ASSERT_NE(f, nullptr);
+    fclose(f);
+  }
+
+  std::string parts = dir + "/p*/part-*.parquet";
+  std::string firsts = dir + "/p?/part-0.parquet";
+  std::string dirs = dir + "/p*/";
+  const char* argv[] = {"./myapp", parts.c_str(), firsts.c_str(),
+                        dirs.c_str()};
+  int argc = 4;
+
+  cli_command* c = cli_command_new();
+  ASSERT_EQ(cli_init(c, "d", "u", argc, (char**)argv), CLI_OK);
+  cli_expand_globs(c, true);
+  const char** rest = nullptr;
+  size_t n_rest = 0;
+  ASSERT_EQ(cli_add_path_arguments(c, &rest, &n_rest, CLI_PATH_ANY), CLI_OK);
+
+  // hidden names need a leading `.` in the pattern, files never match `p*/`
+  ASSERT_EQ(cli_parse(c), CLI_OK);
+  ASSERT_EQ(n_rest, 10u);
+  ASSERT_EQ(rest[0], dir + "/p1/part-0.parquet");
+  ASSERT_EQ(rest[1], dir + "/p1/part-1.parquet");
+  ASSERT_EQ(rest[2], dir + "/p2/part-0.parquet");
+  ASSERT_EQ(rest[3], dir + "/p3/part-0.parquet");
+  ASSERT_EQ(rest[4], dir + "/p1/part-0.parquet");
+  ASSERT_EQ(rest[5], dir + "/p2/part-0.parquet");
+  ASSERT_EQ(rest[6], dir + "/p3/part-0.parquet");
+  ASSERT_EQ(rest[7], dir + "/p1/");
+  ASSERT_EQ(rest[8], dir + "/p2/");
+  ASSERT_EQ(rest[9], dir + "/p3/");
+
+  cli_command_destroy(c);
+  for (const char* name : files) {
+    remove((dir + "/" + name).c_str());
+  }
+  for (const char* sub : subdirs) {
+    rmdir((dir + "/" + sub).c_str());
+  }
+  rmdir(dir.c_str());
+}
+
+TEST(public, test_cli_parse_file_option_maps_contents) {
+  char path[] = "/tmp/cli_file_XXXXXX";
+  int fd = mkstemp(path);
+  ASSERT_GE(fd, 0);
+  const char contents[] = "{\"fields\": []}";
+  ASSERT_EQ(write(fd, contents, sizeof(contents) - 1),
+            (ssize_t)sizeof(contents) - 1);
+  close(fd);
+
+  std::string schema = std::string("--schema=@") + path;
+  std::string keys = std::string("--keys=") + path;
+  const char* argv[] = {"./myapp", schema.c_str(), keys.c_str()};
+  int argc = 3;
+
+  cli_command* c = cli_command_new();
+  ASSERT_EQ(cli_init(c, "d", "u", argc, (char**)argv), CLI_OK);
+
+  cli_span schema_span = {nullptr, 0};
+  ASSERT_EQ(cli_add_file_option(c, "schema", "usage", &schema_span, true),
+            CLI_OK);
+  cli_span keys_span = {nullptr, 0};
+  ASSERT_EQ(cli_add_file_option(c, "keys", "usage", &keys_span, false),
+            CLI_OK);
+
+  ASSERT_EQ(cli_parse(c), CLI_OK);
+  ASSERT_EQ(std::string((const char*)schema_span.ptr, schema_span.len),
+            contents);
+  ASSERT_EQ(std::string((const char*)keys_span.ptr, keys_span.len), contents);
+
+  // pipes are read rather than mapped
+  int fds[2];
+  ASSERT_EQ(pipe(fds), 0);
+  ASSERT_EQ(write(fds[1], "abc", 3), 3);
+  close(fds[1]);
+  std::string from_pipe = "--schema=@/dev/fd/" + std::to_string(fds[0]);
+  cli_begin(c);
+  ASSERT_EQ(cli_feed(c, from_pipe.data(), from_pipe.size()), CLI_OK);
+  ASSERT_EQ(cli_finish(c), CLI_OK);
+  ASSERT_EQ(std::string((const char*)schema_span.ptr, schema_span.len), "abc");
+  close(fds[0]);
+
+  std::string missing = std::string("--schema=@") + path + ".missing";
+  cli_begin(c);
+  ASSERT_EQ(cli_feed(c, missing.data(), missing.size()),
+            CLI_PARSE_FAILED_FILE);
+
+  cli_command_destroy(c);
+  remove(path);
+}
+
+TEST(public, test_cli_parse_range_sets) {
+  const char* argv[] = {"./myapp", "--cpus=16-23,0-7,64",
+                        "--shards=9-200,1,201-999999999,2-8,1000000000"};
+  int argc = 3;
+
+  cli_command* c = cli_command_new();
+  ASSERT_EQ(cli_init(c, "d", "u", argc, (char**)argv), CLI_OK);
+
+  uint64_t cpus[2] = {~0ull, ~0ull};
+  ASSERT_EQ(cli_add_bitset_option(c, "cpus", "usage", cpus, 128, true),
+            CLI_OK);
+  cli_range shards[2];
+  size_t n_shards = 0;
+  ASSERT_EQ(cli_add_ranges_option(c, "shards", "usage", shards, 2, &n_shards,
+                                  UINT64_MAX, true),
+            CLI_OK);
+
+  // five items merge as they go to fit two slots, then down to one
+  ASSERT_EQ(cli_parse(c), CLI_OK);
+  ASSERT_EQ(cpus[0], 0xff00ffull);
+  ASSERT_EQ(cpus[1], 1ull);
+  ASSERT_EQ(n_shards, 1u);
+  ASSERT_EQ(shards[0].lo, 1u);
+  ASSERT_EQ(shards[0].hi, 1000000000u);
+
+  struct {
+    const char* token;
+    cli_err err;
+  } cases[] = {
+      {"--cpus=0-127", CLI_OK},
+      {"--cpus=0-128", CLI_RANGE_OUT_OF_BOUNDS},
+      {"--cpus=1-5,5", CLI_RANGE_OVERLAP},
+      {"--cpus=7-3", CLI_PARSE_FAILED_RANGE},
+      {"--cpus=1,", CLI_PARSE_FAILED_RANGE},
+      {"--cpus=", CLI_PARSE_FAILED_RANGE},
+      {"--cpus=1;2", CLI_PARSE_FAILED_RANGE},
+      {"--shards=99999999999999999999", CLI_PARSE_FAILED_RANGE},
+      {"--shards=1,3,5", CLI_RANGE_OUT_OF_BOUNDS},
+      {"--shards=10-20,5-10", CLI_RANGE_OVERLAP},
+  };
+  for (auto& tc : cases) {
+    cli_begin(c);
+    ASSERT_EQ(cli_feed(c, tc.token, strlen(tc.token)), tc.err) << tc.token;
+  }
+
+  cli_command_destroy(c);
+}
+
+TEST(public, test_cli_parse_kv_option_collects_pairs) {
+  const char* argv[] = {"./myapp",  "-D",           "log.level=debug", "-D",
+                        "batch=64", "-D=batch=128", "--env=HOME=/root"};
+  int argc = 7;
+
+  cli_command* c = cli_command_new();
+  ASSERT_EQ(cli_init(c, "d", "u", argc, (char**)argv), CLI_OK);
+  cli_set_lazy(c, true);
+
+  const cli_kv* defines = nullptr;
+  ASSERT_EQ(cli_add_kv_option(c, "D", "usage", &defines, CLI_KV_LAST_WINS,
+                              false),
+            CLI_OK);
+  const cli_kv* env = nullptr;
+  ASSERT_EQ(cli_add_kv_option(c, "env", "usage", &env, CLI_KV_UNIQUE, false),
+            CLI_OK);
+
+  ASSERT_EQ(cli_parse(c), CLI_OK);
+  ASSERT_EQ(cli_kv_count(defines), 2u);
+
+  cli_span value;
+  ASSERT_TRUE(cli_kv_get(defines, "batch", 5, &value));
+  ASSERT_EQ(std::string((const char*)value.ptr, value.len), "128");
+  ASSERT_TRUE(cli_kv_get(env, "HOME", 4, &value));
+  ASSERT_EQ(std::string((const char*)value.ptr, value.len), "/root");
+  ASSERT_FALSE(cli_kv_get(env, "PATH", 4, &value));
+
+  // first given order, values point into argv
+  cli_span key;
+  cli_kv_at(defines, 0, &key, &value);
+  ASSERT_EQ(std::string((const char*)key.ptr, key.len), "log.level");
+  ASSERT_EQ(value.ptr, argv[2] + 10);
+
+  // tables survive a snapshot, pointing into the blob
+  char blob[256];
+  size_t len = 0;
+  ASSERT_EQ(cli_snapshot_write(c, blob, sizeof(blob), &len), CLI_OK);
+  ASSERT_EQ(cli_snapshot_read(c, blob, len), CLI_OK);
+  ASSERT_EQ(cli_kv_count(defines), 2u);
+  ASSERT_TRUE(cli_kv_get(defines, "batch", 5, &value));
+  ASSERT_EQ(std::string((const char*)value.ptr, value.len), "128");
+  ASSERT_TRUE(cli_kv_get(env, "HOME", 4, &value));
+  ASSERT_EQ(std::string((const char*)value.ptr, value.len), "/root");
+
+  // enough keys to grow the table, plus the error cases
+  cli_begin(c);
+  std::vector<std::string> tokens;
+  for (int i = 0; i < 100; i++) {
+    tokens.push_back("-D=k" + std::to_string(i) + "=" + std::to_string(i));
+  }
+  for (auto& t : tokens) {
+    ASSERT_EQ(cli_feed(c, t.data(), t.size()), CLI_OK);
+  }
+  ASSERT_EQ(cli_finish(c), CLI_OK);
+  ASSERT_EQ(cli_kv_count(defines), 100u);
+  ASSERT_EQ(cli_kv_count(env), 0u);
+  ASSERT_TRUE(cli_kv_get(defines, "k77", 3, &value));
+  ASSERT_EQ(std::string((const char*)value.ptr, value.len), "77");
+
+  cli_begin(c);
+  ASSERT_EQ(cli_feed(c, "--env=A=1", 9), CLI_OK);
+  ASSERT_EQ(cli_feed(c, "--env=A=2", 9), CLI_DUPLICATE_KEY);
+  cli_begin(c);
+  ASSERT_EQ(cli_feed(c, "-D=novalue", 10), CLI_PARSE_FAILED_KV);
+  cli_begin(c);
+  ASSERT_EQ(cli_feed(c, "-D==x", 5), CLI_PARSE_FAILED_KV);
+
+  cli_command_destroy(c);
+}
+
+TEST(public, test_cli_live_reload_publishes_consistent_tables) {
+  const char* argv[] = {"./myapp"};
+  cli_command* c = cli_command_new();
+  ASSERT_EQ(cli_init(c, "d", "u", 1, (char**)argv), CLI_OK);
+
+  int a = 1;
+  ASSERT_EQ(cli_add_int_option(c, "a", "usage", &a, false), CLI_OK);
+  int b = 1;
+  ASSERT_EQ(cli_add_int_option(c, "b", "usage", &b, false), CLI_OK);
+  char level[8] = "info";
+  ASSERT_EQ(cli_add_str_option(c, "level", "usage", level, false, 8), CLI_OK);
+  int threads = 2;
+  cli_command* pool = cli_group_new();
+  ASSERT_EQ(cli_add_int_option(pool, "threads", "usage", &threads, false),
+            CLI_OK);
+  ASSERT_EQ(cli_add_group(c, pool), CLI_OK);
+  cli_command_destroy(pool);
+
+  cli_live* live = cli_live_new(c);
+  size_t slot_a = cli_live_slot(live, "a");
+  size_t slot_b = cli_live_slot(live, "b");
+  size_t slot_level = cli_live_slot(live, "level");
+  size_t slot_threads = cli_live_slot(live, "threads");
+  ASSERT_NE(slot_threads, SIZE_MAX);
+  ASSERT_EQ(cli_live_slot(live, "nope"), SIZE_MAX);
+
+  const cli_values* v;
+  unsigned token = cli_live_acquire(live, &v);
+  ASSERT_EQ(*(const int*)cli_values_get(v, slot_a), 1);
+  ASSERT_STREQ((const char*)cli_values_get(v, slot_level), "info");
+  ASSERT_FALSE(cli_values_seen(v, slot_a));
+  cli_live_release(live, token);
+
+  // every reload starts from the defaults, group options included
+  char line[] = "--level=debug --a=5 --threads=8";
+  ASSERT_EQ(cli_live_reload_line(live, line, strlen(line)), CLI_OK);
+  token = cli_live_acquire(live, &v);
+  ASSERT_EQ(*(const int*)cli_values_get(v, slot_threads), 8);
+  ASSERT_TRUE(cli_values_seen(v, slot_threads));
+  cli_live_release(live, token);
+  const char* next[] = {"./myapp", "--b=7"};
+  ASSERT_EQ(cli_live_reload(live, 2, (char**)next), CLI_OK);
+  token = cli_live_acquire(live, &v);
+  ASSERT_EQ(*(const int*)cli_values_get(v, slot_a), 1);
+  ASSERT_EQ(*(const int*)cli_values_get(v, slot_b), 7);
+  ASSERT_STREQ((const char*)cli_values_get(v, slot_level), "info");
+  ASSERT_EQ(*(const int*)cli_values_get(v, slot_threads), 2);
+  ASSERT_TRUE(cli_values_seen(v, slot_b));
+  cli_live_release(live, token);
+
+  // a failed reload publishes nothing
+  const char* bad[] = {"./myapp", "--a=x"};
+  ASSERT_EQ(cli_live_reload(live, 2, (char**)bad), CLI_PARSE_FAILED_INT);
+  token = cli_live_acquire(live, &v);
+  ASSERT_EQ(*(const int*)cli_values_get(v, slot_b), 7);
+  cli_live_release(live, token);
+
+  // readers never see a torn table while reloads keep swapping them
+  const char* even[] = {"./myapp", "--b=1"};
+  ASSERT_EQ(cli_live_reload(live, 2, (char**)even), CLI_OK);
+  std::atomic<bool> stop{false};
+  std::atomic<int> torn{0};
+  std::vector<std::thread> readers;
+  for (int t = 0; t < 4; t++) {
+    readers.emplace_back([&] {
+      while (!stop) {
+        const cli_values* mine;
+        unsigned tok = cli_live_acquire(live, &mine);
+        int x = *(const int*)cli_values_get(mine, slot_a);
+        int y = *(const int*)cli_values_get(mine, slot_b);
+        torn += x != y;
+        cli_live_release(live, tok);
+      }
+    });
+  }
+  for (int i = 0; i < 2000; i++) {
+    std::string n = std::to_string(i);
+    std::string opt_a = "--a=" + n;
+    std::string opt_b = "--b=" + n;
+    char* reload[] = {(char*)"./myapp", opt_a.data(), opt_b.data()};
+    ASSERT_EQ(cli_live_reload(live, 3, reload), CLI_OK);
+  }
+  stop = true;
+  for (auto& r : readers) {
+    r.join();
+  }
+  ASSERT_EQ(torn, 0);
+
+  cli_live_destroy(live);
+  cli_command_destroy(c);
+}
+
+TEST(public, test_cli_parse_streams_last_argument) {
+  char path[] = "/tmp/cli_stream_XXXXXX";
+  int fd = mkstemp(path);
+  ASSERT_GE(fd, 0);
+  const char records[] = "1\0002\0\00039";
+  ASSERT_EQ(write(fd, records, sizeof(records) - 1),
+            (ssize_t)sizeof(records) - 1);
+
+  const char* argv[] = {"./myapp", "--scale=2"};
+  cli_command* c = cli_command_new();
+  ASSERT_EQ(cli_init(c, "d", "u", 2, (char**)argv), CLI_OK);
+  int scale = 0;
+  ASSERT_EQ(cli_add_int_option(c, "scale", "usage", &scale, true), CLI_OK);
+  int item = 0;
+  ASSERT_EQ(cli_add_int_argument(c, &item), CLI_OK);
+
+  // the callback sees each record already parsed into the argument
+  struct ctx_t {
+    std::vector<int> seen;
+    int* item;
+    int* scale;
+  } ctx = {{}, &item, &scale};
+  auto cb = [](void* p, size_t i) {
+    auto* x = (ctx_t*)p;
+    x->seen.push_back(*x->item * *x->scale);
+    return i + 1 == x->seen.size() ? CLI_OK : CLI_ARG_COUNT;
+  };
+  ASSERT_EQ(cli_stream_arguments(c, fd, '\0', cb, &ctx), CLI_OK);
+  ASSERT_EQ(cli_add_int_argument(c, &item), CLI_ARG_COUNT);
+
+  ASSERT_EQ(lseek(fd, 0, SEEK_SET), 0);
+  ASSERT_EQ(cli_parse(c), CLI_OK);
+  ASSERT_EQ(ctx.seen, (std::vector<int>{2, 4, 78}));
+  ASSERT_EQ(cli_streamed(c), 3u);
+
+  // the streamed argument can't also come from argv
+  cli_begin(c);
+  ASSERT_EQ(cli_feed(c, "--scale=1", 9), CLI_OK);
+  ASSERT_EQ(cli_feed(c, "7", 1), CLI_ARG_COUNT);
+
+  // a bad record stops the stream at its index
+  const char bad[] = "5\0x\0006";
+  ASSERT_EQ(ftruncate(fd, 0), 0);
+  ASSERT_EQ(pwrite(fd, bad, sizeof(bad) - 1, 0), (ssize_t)sizeof(bad) - 1);
+  ASSERT_EQ(lseek(fd, 0, SEEK_SET), 0);
+  ctx.seen.clear();
+  ASSERT_EQ(cli_parse(c), CLI_PARSE_FAILED_INT);
+  ASSERT_EQ(cli_streamed(c), 1u);
+  cli_command_destroy(c);
+
+  // a record has to fit in one read
+  std::string lines = "ok\n" + std::string(CLI_STREAM_CHUNK, 'a') + "\n";
+  ASSERT_EQ(ftruncate(fd, 0), 0);
+  ASSERT_EQ(pwrite(fd, lines.data(), lines.size(), 0), (ssize_t)lines.size());
+  ASSERT_EQ(lseek(fd, 0, SEEK_SET), 0);
+  c = cli_command_new();
+  ASSERT_EQ(cli_init(c, "d", "u", 1, (char**)argv), CLI_OK);
+  char word[8];
+  ASSERT_EQ(cli_add_str_argument(c, word, sizeof(word)), CLI_OK);
+  size_t n = 0;
+  auto count = [](void* p, size_t) {
+    (*(size_t*)p)++;
+    return CLI_OK;
+  };
+  ASSERT_EQ(cli_stream_arguments(c, fd, '\n', count, &n), CLI_OK);
+  ASSERT_EQ(cli_parse(c), CLI_STREAM_RECORD_TOO_LONG);
+  ASSERT_EQ(n, 1u);
+  ASSERT_STREQ(word, "ok");
+
+  cli_command_destroy(c);
+  close(fd);
+  remove(path);
+}
+
+TEST(public, test_cli_parse_embedded_reports_error_context) {
+  const char* argv[] = {"./myapp", "-v", "--n=x"};
+  cli_command* c = cli_command_try_new();
+  ASSERT_NE(c, nullptr);
+  ASSERT_EQ(cli_init(c, "d", "u", 3, (char**)argv), CLI_OK);
+  cli_set_embedded(c, true);
+
+  bool v = false;
+  ASSERT_EQ(cli_add_flag(c, "v", "usage", &v), CLI_OK);
+  int n = 0;
+  ASSERT_EQ(cli_add_int_option(c, "n", "usage", &n, true), CLI_OK);
+
+  ASSERT_EQ(cli_parse(c), CLI_PARSE_FAILED_INT);
+  cli_error e = cli_last_error(c);
+  ASSERT_EQ(e.code, CLI_PARSE_FAILED_INT);
+  ASSERT_EQ(e.index, 2);
+  ASSERT_EQ(std::string(e.token, e.token_len), "--n=x");
+  ASSERT_STREQ(e.option, "n");
+
+  char buf[128];
+  std::string want = "-n: token parse failed for integer. (argv[2] \"--n=x\")";
+  ASSERT_EQ(cli_format_error(&e, buf, sizeof(buf)), want.size());
+  ASSERT_EQ(buf, want);
+  // truncated like snprintf
+  char small[8];
+  ASSERT_EQ(cli_format_error(&e, small, sizeof(small)), want.size());
+  ASSERT_EQ(std::string(small), want.substr(0, 7));
+
+  // help and the completion command come back instead of exiting
+  const char* help[] = {"./myapp", "--help"};
+  cli_cleanup(c);
+  ASSERT_EQ(cli_init(c, "d", "u", 2, (char**)help), CLI_OK);
+  cli_set_embedded(c, true);
+  ASSERT_EQ(cli_parse(c), CLI_PRINT_HELP_AND_EXIT);
+  cli_cleanup(c);
+  const char* complete[] = {"./myapp", "__complete", "-"};
+  ASSERT_EQ(cli_init(c, "d", "u", 3, (char**)complete), CLI_OK);
+  cli_set_embedded(c, true);
+  ASSERT_EQ(cli_parse(c), CLI_ARG_COUNT);
+  e = cli_last_error(c);
+  ASSERT_EQ(e.index, 1);
+  ASSERT_EQ(e.option, nullptr);
+
+  // failures at the end of the line have no token
+  ASSERT_EQ(cli_add_int_option(c, "n", "usage", &n, true), CLI_OK);
+  cli_begin(c);
+  ASSERT_EQ(cli_finish(c), CLI_UNSEEN_REQ_OPTS);
+  e = cli_last_error(c);
+  ASSERT_EQ(e.index, -1);
+  ASSERT_EQ(e.token, nullptr);
+  ASSERT_STREQ(e.option, "n");
+  cli_begin(c);
+  ASSERT_EQ(cli_feed(c, "--n", 3), CLI_OK);
+  ASSERT_EQ(cli_finish(c), CLI_OUT_OF_BOUNDS);
+  ASSERT_STREQ(cli_last_error(c).option, "n");
+  ASSERT_STREQ(cli_err_str(CLI_OUT_OF_MEMORY), "out of memory.");
+
+  cli_command_destroy(c);
+}
+
+TEST(public, test_cli_parse_into_fills_many_structs) {
+  struct cfg_t {
+    bool verbose;
+    int n;
+    float ratio;
+    char name[16];
+    uint64_t size;
+    int64_t timeout;
+    int pos;
+  };
+  const cfg_t defaults = {false, 3, 0.5f, "anon", 1024, 0, 0};
+
+  const char* argv0[] = {"./myapp"};
+  cli_command* c = cli_command_new();
+  ASSERT_EQ(cli_init(c, "d", "u", 1, (char**)argv0), CLI_OK);
+  ASSERT_EQ(cli_add_field_option(c, "n", "usage", CLI_FIELD_INT,
+                                 offsetof(cfg_t, n), sizeof(int), false),
+            CLI_NOT_BOUND);
+  ASSERT_EQ(cli_bind_struct(c, &defaults, sizeof(cfg_t)), CLI_OK);
+  ASSERT_EQ(cli_bind_struct(c, &defaults, sizeof(cfg_t)), CLI_ALREADY_BOUND);
+
+  ASSERT_EQ(cli_add_field_option(c, "verbose", "usage", CLI_FIELD_FLAG,
+                                 offsetof(cfg_t, verbose), sizeof(bool),
+                                 false),
+            CLI_OK);
+  ASSERT_EQ(cli_add_field_option(c, "n", "usage", CLI_FIELD_INT,
+                                 offsetof(cfg_t, n), sizeof(int), false),
+            CLI_OK);
+  ASSERT_EQ(cli_add_field_option(c, "ratio", "usage", CLI_FIELD_FLOAT,
+                                 offsetof(cfg_t, ratio), sizeof(float), false),
+            CLI_OK);
+  ASSERT_EQ(cli_add_field_option(c, "name", "usage", CLI_FIELD_STR,
+                                 offsetof(cfg_t, name), 16, false),
+            CLI_OK);
+  ASSERT_EQ(cli_add_field_option(c, "size", "usage", CLI_FIELD_SIZE,
+                                 offsetof(cfg_t, size), sizeof(uint64_t),
+                                 false),
+            CLI_OK);
+  ASSERT_EQ(cli_add_field_option(c, "timeout", "usage", CLI_FIELD_DURATION,
+                                 offsetof(cfg_t, timeout), sizeof(int64_t),
+                                 false),
+            CLI_OK);
+  ASSERT_EQ(cli_add_field_argument(c, CLI_FIELD_INT, offsetof(cfg_t, pos),
+                                   sizeof(int)),
+            CLI_OK);
+
+  // fields have to fit and match their type
+  ASSERT_EQ(cli_add_field_option(c, "x", "usage", CLI_FIELD_INT,
+                                 sizeof(cfg_t) - 2, sizeof(int), false),
+            CLI_OUT_OF_BOUNDS);
+  ASSERT_EQ(cli_add_field_option(c, "x", "usage", CLI_FIELD_SIZE,
+                                 offsetof(cfg_t, n), sizeof(int), false),
+            CLI_TYPE_MISMATCH);
+
+  const char* first[] = {"./myapp", "--verbose", "--n=5", "--name=bob",
+                         "--size=2KiB", "--timeout=2s", "7"};
+  cfg_t a;
+  ASSERT_EQ(cli_parse_into(c, 7, (char**)first, &a), CLI_OK);
+  ASSERT_TRUE(a.verbose);
+  ASSERT_EQ(a.n, 5);
+  ASSERT_FLOAT_EQ(a.ratio, 0.5f);
+  ASSERT_STREQ(a.name, "bob");
+  ASSERT_EQ(a.size, 2048u);
+  ASSERT_EQ(a.timeout, 2000000000);
+  ASSERT_EQ(a.pos, 7);
+
+  // nothing carries over from the last struct, untouched fields get defaults
+  const char* second[] = {"./myapp", "--ratio=2", "9"};
+  cfg_t b;
+  ASSERT_EQ(cli_parse_into(c, 3, (char**)second, &b), CLI_OK);
+  ASSERT_FALSE(b.verbose);
+  ASSERT_EQ(b.n, 3);
+  ASSERT_FLOAT_EQ(b.ratio, 2.0f);
+  ASSERT_STREQ(b.name, "anon");
+  ASSERT_EQ(b.pos, 9);
+  ASSERT_EQ(a.n, 5);
+
+  // lazy values land in the struct too
+  cli_set_lazy(c, true);
+  ASSERT_EQ(cli_parse_into(c, 7, (char**)first, &b), CLI_OK);
+  ASSERT_EQ(b.n, 5);
+  ASSERT_EQ(b.size, 2048u);
+  cli_set_lazy(c, false);
+
+  // help is only reported and the command never keeps the caller's argv
+  {
+    std::vector<std::string> held = {"./myapp", "--help"};
+    char* args[] = {held[0].data(), held[1].data()};
+    ASSERT_EQ(cli_parse_into(c, 2, args, &b), CLI_PRINT_HELP_AND_EXIT);
+  }
+  ASSERT_EQ(cli_parse(c), CLI_ARG_COUNT);
+
+  // options without a field have nowhere to go, fields are given once
+  int plain = 0;
+  ASSERT_EQ(cli_add_int_option(c, "plain", "usage", &plain, false), CLI_OK);
+  const char* unbound[] = {"./myapp", "--plain=1", "4"};
+  ASSERT_EQ(cli_parse_into(c, 3, (char**)unbound, &b), CLI_NOT_BOUND);
+  const char* twice[] = {"./myapp", "--n=1", "--n", "2", "4"};
+  ASSERT_EQ(cli_parse_into(c, 5, (char**)twice, &b), CLI_ALREADY_SEEN);
+
+  // one command, many threads, each with its own struct
+  std::atomic<int> wrong{0};
+  std::vector<std::thread> workers;
+  for (int t = 0; t < 4; t++) {
+    workers.emplace_back([&, t] {
+      std::string n = "--n=" + std::to_string(t);
+      std::string pos = std::to_string(t * 10);
+      char* args[] = {(char*)"./myapp", n.data(), pos.data()};
+      for (int i = 0; i < 200; i++) {
+        cfg_t mine;
+        wrong += cli_parse_into(c, 3, args, &mine) != CLI_OK ||
+                 mine.n != t || mine.pos != t * 10 || mine.size != 1024;
+      }
+    });
+  }
+  for (auto& w : workers) {
+    w.join();
+  }
+  ASSERT_EQ(wrong, 0);
+
+  cli_command_destroy(c);
+}